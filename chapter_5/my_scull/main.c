@@ -0,0 +1,2039 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+#include <linux/kernel.h>   /* printk, container_of */
+#include <linux/slab.h>     /* kmalloc, kmem_cache */
+#include <linux/mm.h>       /* everything mmap, __get_free_pages */
+#include <linux/fs.h>       /* everything...*/
+#include <linux/types.h>    /* size_t, dev_t, MAJOR, MINOR, MKDEV */
+#include <linux/proc_fs.h>  /* writing to /proc for debugging */
+#include <linux/seq_file.h> /* writing to /proc for debugging */
+#include <linux/string.h>   /* memset */
+#include <linux/fcntl.h>    /* O_ACCMODE */
+#include <linux/cdev.h>     /* cdev */
+#include <linux/radix-tree.h> /* the quantum set index */
+#include <linux/rcupdate.h> /* rcu_assign_pointer */
+#include <linux/srcu.h>     /* readers that sleep in copy_to_user */
+#include <linux/mutex.h>    /* per quantum set writer lock */
+#include <linux/spinlock.h> /* the store's index and size */
+#include <linux/workqueue.h> /* freeing trimmed data in the background */
+#include <linux/cpu.h>      /* spreading teardown over the CPUs */
+#include <linux/sched.h>    /* cond_resched */
+#include <linux/uio.h>      /* struct iovec, for readv/writev */
+#include <linux/math64.h>   /* 64-bit offsets on 32-bit machines */
+#include <linux/seqlock.h>
+#include <linux/log2.h>     /* power-of-two geometry */
+#include <linux/ktime.h>    /* latency histograms */
+#include <linux/pipe_fs_i.h> /* pipe buffers, for splice */
+#include <linux/splice.h>
+
+#include <asm/uaccess.h>  /* copy_*_user */
+
+#include "my_scull.h"
+#include "my_scull_store.h"
+
+#define CREATE_TRACE_POINTS
+#include "my_scull_trace.h"
+
+/*
+ * Our parameters which can be set at load time.
+ * Make them available for insmod to assign values at load time.
+ */
+int my_scull_major   = MY_SCULL_MAJOR;
+int my_scull_minor   = 0;
+int my_scull_nr_devs = MY_SCULL_NR_DEVS;
+int my_scull_quantum = MY_SCULL_QUANTUM;
+int my_scull_qset    = MY_SCULL_QSET;
+
+module_param(my_scull_major, int, S_IRUGO);
+module_param(my_scull_minor, int, S_IRUGO);
+module_param(my_scull_nr_devs, int, S_IRUGO);
+module_param(my_scull_quantum, int, S_IRUGO);
+module_param(my_scull_qset, int, S_IRUGO);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("Bobby Pearson");
+MODULE_DESCRIPTION("My Scull - Simple Character Utility for Loading Localities");
+MODULE_VERSION("1.0");
+
+struct my_scull_dev *scull_devices;  /* allocated in my_scull_init_module */
+
+/*
+ * Trimmed stores are freed here, off the path of whoever trimmed them.
+ * It is a multithreaded queue so that unloading can free every device
+ * at once, one per CPU.
+ */
+static struct workqueue_struct *my_scull_wq;
+
+/*
+ * Latency histograms: bucket b counts what took from 2^(b-1) up to
+ * 2^b nanoseconds, and the last bucket everything longer than that.
+ */
+static inline int my_scull_hist_bucket(u64 ns)
+{
+  return ns ? min_t(int, ilog2(ns) + 1, MY_SCULL_HIST_BUCKETS - 1) : 0;
+}
+
+#define MY_SCULL_HIST_ADD(dev, hist, ns) \
+  this_cpu_inc((dev)->stats->hist[my_scull_hist_bucket(ns)])
+
+/*
+ * The workqueue end of trimming: wait until no reader can still be
+ * looking at the store, then free it.
+ */
+void my_scull_free_store_work(struct work_struct *work)
+{
+  struct my_scull_store *store =
+    container_of(work, struct my_scull_store, free_work);
+
+  synchronize_srcu(&store->dev->srcu);
+  my_scull_free_store(store);
+}
+
+/*
+ * Let go of a store. The device holds a reference to its current one,
+ * and so does anything still to be freed from it (see my_scull_reap);
+ * the last one out hands it to my_scull_wq.
+ */
+static void my_scull_put_store(struct my_scull_store *store)
+{
+  if (atomic_dec_and_test(&store->refs))
+    queue_work(my_scull_wq, &store->free_work);
+}
+
+/*
+ * Empty out the device. The caller holds dev->sem for writing.
+ *
+ * This only swaps a fresh store in for the old one, however much data
+ * there is. Readers may still be working on the old contents, so it
+ * is handed to my_scull_wq, which frees it once they are done.
+ */
+int my_scull_trim(struct my_scull_dev *dev)
+{
+  struct my_scull_store *old = dev->store, *store;
+  int retval = 0;
+
+  trace_my_scull_trim_enter(MY_SCULL_MINOR(dev), old->size);
+  if (atomic_read(&dev->vmas)) { /* don't trim: there are active mappings */
+    retval = -EBUSY;
+    goto out;
+  }
+
+  store = my_scull_alloc_store(dev, dev->quantum, dev->qset);
+  if (!store) {
+    retval = -ENOMEM;
+    goto out;
+  }
+  rcu_assign_pointer(dev->store, store);
+  my_scull_put_store(old);
+  MY_SCULL_STAT_INC(dev, trims);
+
+ out:
+  trace_my_scull_trim_exit(MY_SCULL_MINOR(dev), retval);
+  return retval;
+}
+
+/*
+ * Quanta and quantum sets taken out of a store that is still in use
+ * can't be freed on the spot, as a lockless reader may be in the middle
+ * of them. They are gathered a page at a time, and each full page goes
+ * to my_scull_wq, which frees what is on it once the readers have moved
+ * on. Whoever took them out never waits for the readers themselves:
+ * they hold dev->sem, and a reader may be faulting in copy_to_user on
+ * a page whose mmap_sem is held by an mmap waiting for dev->sem.
+ *
+ * Each page holds a reference to the store, so that a trim meanwhile
+ * leaves it for the last page to free.
+ */
+struct my_scull_reap {
+  struct work_struct work;
+  struct my_scull_store *store;
+  int nr_quanta;              /* quanta from the front of ptrs, */
+  int nr_qsets;               /* quantum sets from the back */
+  void *ptrs[];
+};
+
+#define MY_SCULL_REAP_PTRS \
+  ((PAGE_SIZE - sizeof(struct my_scull_reap)) / sizeof(void *))
+
+static void my_scull_reap_work(struct work_struct *work)
+{
+  struct my_scull_reap *reap = container_of(work, struct my_scull_reap, work);
+  struct my_scull_store *store = reap->store;
+  int i;
+
+  synchronize_srcu(&store->dev->srcu);
+  for (i = 0; i < reap->nr_quanta; i++)
+    my_scull_free_quantum(store, reap->ptrs[i]);
+  for (i = 0; i < reap->nr_qsets; i++)
+    my_scull_free_qset(store, reap->ptrs[MY_SCULL_REAP_PTRS - 1 - i]);
+  free_page((unsigned long) reap);
+  my_scull_put_store(store);
+}
+
+/*
+ * Start a page of things to free. The caller holds dev->sem, so the
+ * store is still the device's.
+ */
+struct my_scull_reap *my_scull_reap_alloc(struct my_scull_store *store,
+                                          gfp_t gfp)
+{
+  struct my_scull_reap *reap;
+
+  reap = (struct my_scull_reap *) __get_free_page(gfp);
+  if (!reap)
+    return NULL;
+  INIT_WORK(&reap->work, my_scull_reap_work);
+  reap->store = store;
+  reap->nr_quanta = reap->nr_qsets = 0;
+  atomic_inc(&store->refs);
+  return reap;
+}
+
+/* send the page off to be freed, if there is anything on it */
+void my_scull_reap_done(struct my_scull_reap *reap)
+{
+  if (reap->nr_quanta || reap->nr_qsets) {
+    queue_work(my_scull_wq, &reap->work);
+    return;
+  }
+  atomic_dec(&reap->store->refs); /* never the last, the device has one */
+  free_page((unsigned long) reap);
+}
+
+/*
+ * Make room for one more. A full page is sent off and another started;
+ * by then we are half way through taking things apart and can't stop,
+ * so that one must not fail.
+ */
+static void my_scull_reap_make_room(struct my_scull_reap **reap)
+{
+  struct my_scull_store *store = (*reap)->store;
+
+  if ((*reap)->nr_quanta + (*reap)->nr_qsets < MY_SCULL_REAP_PTRS)
+    return;
+  my_scull_reap_done(*reap); /* which may be gone as soon as it's queued */
+  *reap = my_scull_reap_alloc(store, GFP_KERNEL | __GFP_NOFAIL);
+}
+
+/* a quantum its quantum set no longer points to */
+void my_scull_reap_quantum(struct my_scull_reap **reap, void *quantum)
+{
+  my_scull_reap_make_room(reap);
+  (*reap)->ptrs[(*reap)->nr_quanta++] = quantum;
+  atomic_dec(&(*reap)->store->nr_quanta);
+}
+
+/* a quantum set already deleted from the index */
+void my_scull_reap_qset(struct my_scull_reap **reap,
+                        struct my_scull_qset *dataptr)
+{
+  struct my_scull_store *store = (*reap)->store;
+  int i;
+
+  for (i = 0; i < store->qset; i++)
+    if (dataptr->data[i])
+      atomic_dec(&store->nr_quanta);
+  atomic_dec(&store->nr_qsets);
+  my_scull_reap_make_room(reap);
+  (*reap)->ptrs[MY_SCULL_REAP_PTRS - 1 - (*reap)->nr_qsets++] = dataptr;
+}
+
+#ifdef MY_SCULL_DEBUG /* use proc only if debugging */
+
+/*
+ * The proc filesystem. Neither file takes dev->sem: they look at the
+ * stores the way readers do, under SRCU, so they never hold up I/O.
+ */
+
+/*
+ * What a store looks like right now, in numbers
+ */
+struct my_scull_snapshot {
+  loff_t size;
+  int quantum, qset;
+  int nr_qsets, nr_quanta;
+  u64 footprint;
+};
+
+/* the caller holds the device's SRCU */
+static void my_scull_snapshot(struct my_scull_store *store,
+                              struct my_scull_snapshot *snap)
+{
+  snap->size = my_scull_size(store);
+  snap->quantum = store->quantum;
+  snap->qset = store->qset;
+  snap->nr_qsets = atomic_read(&store->nr_qsets);
+  snap->nr_quanta = atomic_read(&store->nr_quanta);
+  snap->footprint = my_scull_footprint(store);
+}
+
+/*
+ * /proc/myscullmem is the summary: a few lines per device, and no
+ * walking of the index.
+ */
+int my_scull_read_procmem(char *buf, char **start, off_t offset,
+                          int count, int *eof, void *data)
+{
+  struct my_scull_snapshot snap;
+  int i, idx, len = 0;
+  int limit = count - 160; /* Don't print more than this */
+
+  for (i = 0; i < my_scull_nr_devs && len <= limit; i++) {
+    struct my_scull_dev *d = &scull_devices[i];
+
+    idx = srcu_read_lock(&d->srcu);
+    my_scull_snapshot(srcu_dereference(d->store, &d->srcu), &snap);
+    srcu_read_unlock(&d->srcu, idx);
+
+    len += sprintf(buf + len, "\nDevice %i: qset %i, q % i, sz %lli\n",
+                   i, snap.qset, snap.quantum, (long long) snap.size);
+    len += sprintf(buf + len, "  %i qsets, %i quanta, %llu bytes allocated\n",
+                   snap.nr_qsets, snap.nr_quanta,
+                   (unsigned long long) snap.footprint);
+  }
+  *eof = 1;
+  return len;
+}
+
+/*
+ * /proc/myscullseq is the detailed view, a line per quantum set. The
+ * position is kept in a my_scull_seq_iter rather than worked out from
+ * the file offset. A device's SRCU is only held from start to stop,
+ * i.e. for one buffer's worth. In between we remember just the device
+ * and list item, and look them up again when we carry on.
+ */
+struct my_scull_seq_iter {
+  loff_t pos;                 /* the record we are at: */
+  int dev;                    /* in this device, */
+  int header;                 /* its summary line, or */
+  unsigned long item;         /* the first quantum set from here */
+  struct my_scull_qset *qs;   /* found, good from start to stop only */
+  struct my_scull_store *store;
+  int idx;                    /* our hold on the device's SRCU */
+};
+
+static void my_scull_seq_enter(struct my_scull_seq_iter *it)
+{
+  struct my_scull_dev *dev = scull_devices + it->dev;
+
+  it->idx = srcu_read_lock(&dev->srcu);
+  it->store = srcu_dereference(dev->store, &dev->srcu);
+}
+
+static void my_scull_seq_leave(struct my_scull_seq_iter *it)
+{
+  srcu_read_unlock(&scull_devices[it->dev].srcu, it->idx);
+}
+
+/*
+ * Settle on the first record at or after where it says. Returns 0 if
+ * there are none left, otherwise the device is entered.
+ */
+static int my_scull_seq_find(struct my_scull_seq_iter *it)
+{
+  for (; it->dev < my_scull_nr_devs; it->dev++, it->header = 1) {
+    my_scull_seq_enter(it);
+    if (it->header)
+      return 1;
+    it->qs = my_scull_next_qset(it->store, it->item);
+    if (it->qs) {
+      it->item = it->qs->item;
+      return 1;
+    }
+    my_scull_seq_leave(it);
+  }
+  return 0;
+}
+
+static void *my_scull_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+  struct my_scull_seq_iter *it = v;
+
+  it->pos = ++(*pos);
+  if (it->header) {
+    it->header = 0;
+    it->item = 0;
+  } else {
+    it->item++;
+  }
+  my_scull_seq_leave(it);
+  return my_scull_seq_find(it) ? it : NULL;
+}
+
+static void *my_scull_seq_start(struct seq_file *s, loff_t *pos)
+{
+  struct my_scull_seq_iter *it = s->private;
+
+  /* carry on where we stopped, unless we were moved */
+  if (*pos && *pos == it->pos)
+    return my_scull_seq_find(it) ? it : NULL;
+
+  it->pos = 0;
+  it->dev = 0;
+  it->header = 1;
+  if (!my_scull_seq_find(it))
+    return NULL;
+  while (it->pos < *pos)
+    if (!my_scull_seq_next(s, it, &it->pos))
+      return NULL;
+  return it;
+}
+
+static void my_scull_seq_stop(struct seq_file *s, void *v)
+{
+  if (v) /* we are still in a device */
+    my_scull_seq_leave(v);
+}
+
+static int my_scull_seq_show(struct seq_file *s, void *v)
+{
+  struct my_scull_seq_iter *it = v;
+  struct my_scull_snapshot snap;
+  void **data;
+  int i, n = 0;
+
+  if (it->header) {
+    my_scull_snapshot(it->store, &snap);
+    seq_printf(s, "\nDevice %i: qset %i, q %i, sz %lli\n",
+               it->dev, snap.qset, snap.quantum, (long long) snap.size);
+    seq_printf(s, "  %i qsets, %i quanta, %llu bytes allocated, %llu%% used\n",
+               snap.nr_qsets, snap.nr_quanta,
+               (unsigned long long) snap.footprint,
+               snap.footprint ? div64_u64(snap.size * 100, snap.footprint) : 100ULL);
+    return 0;
+  }
+
+  data = it->qs->data;
+  for (i = 0; i < it->store->qset; i++)
+    if (srcu_dereference(data[i], &it->store->dev->srcu))
+      n++;
+  seq_printf(s, "  item %lu at %p, %i quanta\n", it->item, it->qs, n);
+  return 0;
+}
+
+/*
+ * Tie the sequence operators up.
+ */
+static struct seq_operations my_scull_seq_ops = {
+  .start = my_scull_seq_start,
+  .next  = my_scull_seq_next,
+  .stop  = my_scull_seq_stop,
+  .show  = my_scull_seq_show
+};
+
+/*
+ * Now to implement the /proc file we need only make an open
+ * method which sets up the sequence operators.
+ */
+static int my_scull_proc_open(struct inode *inode, struct file *file)
+{
+  if (!seq_open_private(file, &my_scull_seq_ops,
+                        sizeof(struct my_scull_seq_iter)))
+    return -ENOMEM;
+  return 0;
+}
+
+/*
+ * Create a set of file operations for our proc file.
+ */
+static struct file_operations my_scull_proc_ops = {
+  .owner   = THIS_MODULE,
+  .open    = my_scull_proc_open,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = seq_release_private
+};
+
+/*
+ * Actually create (and remove) the /proc file(s).
+ */
+
+static void my_scull_create_proc(void)
+{
+  struct proc_dir_entry *entry;
+  create_proc_read_entry("myscullmem", 0 /* default mode */,
+                         NULL /* parent dir */, my_scull_read_procmem,
+                         NULL /* client data */);
+  entry = create_proc_entry("myscullseq", 0, NULL);
+  if (entry)
+    entry->proc_fops = &my_scull_proc_ops;
+}
+
+static void my_scull_remove_proc(void)
+{
+  /* no problem if it was not regsitered */
+  remove_proc_entry("myscullmem", NULL /* parent dir */);
+  remove_proc_entry("myscullseq", NULL);
+}
+
+
+#endif /* MY_SCULL_DEBUG */
+
+/*
+ * dev->sem. Every taker keeps count of how often and how long it had
+ * to wait for it, and with nonblock only tries it; the clock is only
+ * read when it is found taken. Once stats/sem_enable is set, it is
+ * also profiled per user (see the enum in my_scull.h): how often each
+ * found it taken, how long it waited and how long it held on. Then
+ * my_scull_sem_down returns, through held, when the semaphore was got,
+ * and my_scull_sem_up wants it back; held is 0 when not profiling.
+ */
+static const struct {
+  const char *name;
+  int exclusive;
+} my_scull_sem_users[MY_SCULL_SEM_NR] = {
+  [MY_SCULL_SEM_TRIM]     = { "trim",     1 },
+  [MY_SCULL_SEM_GEOMETRY] = { "geometry", 1 },
+  [MY_SCULL_SEM_WRITE]    = { "write",    0 },
+  [MY_SCULL_SEM_ALLOC]    = { "alloc",    0 },
+  [MY_SCULL_SEM_RECHUNK]  = { "rechunk",  0 },
+};
+
+static int my_scull_sem_down(struct my_scull_dev *dev, int user, int nonblock,
+                             u64 *held)
+{
+  struct my_scull_sem_prof *prof;
+  int exclusive = my_scull_sem_users[user].exclusive;
+  int profiling = ACCESS_ONCE(dev->sem_prof);
+  u64 start, got = 0, wait = 0;
+
+  *held = 0;
+  if (!(exclusive ? down_write_trylock(&dev->sem) :
+                    down_read_trylock(&dev->sem))) {
+    if (profiling)
+      MY_SCULL_STAT_INC(dev, sem[user].contended);
+    if (nonblock)
+      return -EAGAIN;
+    MY_SCULL_STAT_INC(dev, lock_waits);
+    start = my_scull_now();
+    if (exclusive)
+      down_write(&dev->sem);
+    else
+      down_read(&dev->sem);
+    got = my_scull_now();
+    wait = got - start;
+  }
+
+  if (profiling) {
+    *held = got ? got : my_scull_now();
+    /* the maximum needs a read and a write, so stay on this CPU */
+    prof = &per_cpu_ptr(dev->stats, get_cpu())->sem[user];
+    prof->acquired++;
+    prof->wait_ns += wait;
+    if (wait > prof->wait_max_ns)
+      prof->wait_max_ns = wait;
+    put_cpu();
+  }
+
+  MY_SCULL_HIST_ADD(dev, sem_wait_ns, wait);
+  trace_my_scull_lock_acquire(MY_SCULL_MINOR(dev), MY_SCULL_LOCK_SEM, wait);
+  return 0;
+}
+
+static void my_scull_sem_up(struct my_scull_dev *dev, int user, u64 held)
+{
+  struct my_scull_sem_prof *prof;
+  u64 hold;
+
+  if (held) {
+    hold = my_scull_now() - held;
+    prof = &per_cpu_ptr(dev->stats, get_cpu())->sem[user];
+    prof->hold_ns += hold;
+    if (hold > prof->hold_max_ns)
+      prof->hold_max_ns = hold;
+    put_cpu();
+  }
+
+  trace_my_scull_lock_release(MY_SCULL_MINOR(dev), MY_SCULL_LOCK_SEM);
+  if (my_scull_sem_users[user].exclusive)
+    up_write(&dev->sem);
+  else
+    up_read(&dev->sem);
+}
+
+/*
+ * Open and close
+ */
+
+/*
+ * Do any initialization in preparation for later operations.
+ */
+int my_scull_open(struct inode *inode, struct file *filp)
+{
+  struct my_scull_dev *dev; /* device information */
+  u64 held;
+
+  /*
+   * Identify the device that is being opened
+   * Can get the cdev from inode but we need the dev that this cdev is
+   * contained in
+   */
+  dev = container_of(inode->i_cdev, struct my_scull_dev, cdev);
+  /* Store pointer to make access easier in the future */
+  filp->private_data = dev;
+
+  /* now trim to 0 the length of the device if open was write-only */
+  if ((filp->f_flags & O_ACCMODE) == O_WRONLY) {
+    /* trimming changes everything: we need the semaphore to ourselves */
+    if (my_scull_sem_down(dev, MY_SCULL_SEM_TRIM,
+                          filp->f_flags & O_NONBLOCK, &held))
+      return -EAGAIN;
+    my_scull_trim(dev); /* ignore errors */
+    my_scull_sem_up(dev, MY_SCULL_SEM_TRIM, held); /* release the semaphore no matter what has happened */
+  }
+  return 0; /* success */
+}
+
+/*
+ * Should perform the following tasks:
+ * 1. Deallocate anything that open allocated in filp->private_data
+ * 2. Shut down the device on last close
+ *
+ * This basic form has no hardware to shut down. Nothing was allocated
+ * to filp->private_data in open
+ */
+int my_scull_release(struct inode *inode, struct file *filp)
+{
+  return 0;
+}
+
+/*
+ * Data management: read and write
+ *
+ * Readers take no lock at all. They hold on to the store with SRCU,
+ * which unlike plain RCU lets them sleep in copy_to_user. Writers
+ * publish every pointer a reader can follow behind a write barrier,
+ * and only raise the size once the data under it is in place.
+ *
+ * The device is sparse: whatever was skipped over by a write past the
+ * end was never allocated, and reads back as zeros.
+ *
+ * Both take a list of user buffers, so that readv and writev are
+ * served in one pass; plain read and write hand in a list of one.
+ */
+
+static ssize_t my_scull_do_read(struct my_scull_dev *dev,
+                                const struct iovec *iov,
+                                unsigned long nr_segs, loff_t *f_pos)
+{
+  struct my_scull_iov it = { iov, nr_segs, 0 };
+  size_t count = iov_length(iov, nr_segs);
+  ssize_t retval;
+  u64 start = my_scull_now(), elapsed;
+  int idx;
+
+  trace_my_scull_read_enter(MY_SCULL_MINOR(dev), *f_pos, count);
+
+  /* no lock: just keep whatever store we find from being freed */
+  idx = srcu_read_lock(&dev->srcu);
+  retval = my_scull_store_read(srcu_dereference(dev->store, &dev->srcu),
+                               &it, *f_pos, count);
+  srcu_read_unlock(&dev->srcu, idx);
+  if (retval > 0)
+    *f_pos += retval;
+
+  elapsed = my_scull_now() - start;
+  MY_SCULL_STAT_INC(dev, reads);
+  MY_SCULL_STAT_ADD(dev, read_bytes, retval > 0 ? retval : 0);
+  MY_SCULL_HIST_ADD(dev, read_ns, elapsed);
+  trace_my_scull_read_exit(MY_SCULL_MINOR(dev), retval, elapsed);
+  return retval;
+}
+
+static ssize_t my_scull_do_write(struct my_scull_dev *dev,
+                                 const struct iovec *iov,
+                                 unsigned long nr_segs, loff_t *f_pos,
+                                 int nonblock)
+{
+  struct my_scull_iov it = { iov, nr_segs, 0 };
+  size_t count = iov_length(iov, nr_segs);
+  ssize_t retval;
+  u64 start = my_scull_now(), elapsed, held;
+
+  /*
+   * Holding the semaphore shared only keeps trim away. Writers lock
+   * each quantum set as they get to it, so writes to other parts of
+   * the device carry on alongside this one.
+   *
+   * A nonblocking writer only tries each lock, and gives up with
+   * -EAGAIN (or a short write) rather than wait for one.
+   */
+  trace_my_scull_write_enter(MY_SCULL_MINOR(dev), *f_pos, count);
+  retval = my_scull_sem_down(dev, MY_SCULL_SEM_WRITE, nonblock, &held);
+  if (retval)
+    goto out;
+  retval = my_scull_store_write(dev->store, &it, *f_pos, count, nonblock);
+  my_scull_sem_up(dev, MY_SCULL_SEM_WRITE, held); /* release the semaphore no matter what has happened */
+  if (retval > 0)
+    *f_pos += retval;
+
+ out:
+  elapsed = my_scull_now() - start;
+  MY_SCULL_STAT_INC(dev, writes);
+  MY_SCULL_STAT_ADD(dev, write_bytes, retval > 0 ? retval : 0);
+  MY_SCULL_HIST_ADD(dev, write_ns, elapsed);
+  trace_my_scull_write_exit(MY_SCULL_MINOR(dev), retval, elapsed);
+  return retval;
+}
+
+ssize_t my_scull_read(struct file *filp, char __user *buf, size_t count,
+                      loff_t *f_pos)
+{
+  struct iovec iov = { .iov_base = buf, .iov_len = count };
+
+  return my_scull_do_read(filp->private_data, &iov, 1, f_pos);
+}
+
+ssize_t my_scull_write(struct file *filp, const char __user *buf, size_t count,
+                       loff_t *f_pos)
+{
+  struct iovec iov = { .iov_base = (void __user *) buf, .iov_len = count };
+
+  return my_scull_do_write(filp->private_data, &iov, 1, f_pos,
+                           filp->f_flags & O_NONBLOCK);
+}
+
+/*
+ * The vectored versions, which is what readv and writev end up in
+ */
+ssize_t my_scull_aio_read(struct kiocb *iocb, const struct iovec *iov,
+                          unsigned long nr_segs, loff_t pos)
+{
+  ssize_t retval;
+
+  retval = my_scull_do_read(iocb->ki_filp->private_data, iov, nr_segs, &pos);
+  iocb->ki_pos = pos;
+  return retval;
+}
+
+ssize_t my_scull_aio_write(struct kiocb *iocb, const struct iovec *iov,
+                           unsigned long nr_segs, loff_t pos)
+{
+  ssize_t retval;
+
+  retval = my_scull_do_write(iocb->ki_filp->private_data, iov, nr_segs, &pos,
+                             iocb->ki_filp->f_flags & O_NONBLOCK);
+  iocb->ki_pos = pos;
+  return retval;
+}
+
+/*
+ * Managing memory a quantum at a time: preallocating, punching holes
+ * and truncating. Each stands in for the file system call of the same
+ * purpose, see my_scull.h.
+ */
+
+/*
+ * Allocate everything in [offset, offset + len), so that writes there
+ * find their quanta ready and never allocate. Taken like a write.
+ */
+static int my_scull_prealloc(struct my_scull_dev *dev, loff_t offset,
+                             loff_t len)
+{
+  struct my_scull_store *store;
+  struct my_scull_qset *dataptr;
+  void *quantum_ptr;
+  unsigned long item;
+  int s_pos, q_pos;
+  loff_t pos = offset, end = offset + len;
+  int retval = 0;
+  u64 held;
+
+  my_scull_sem_down(dev, MY_SCULL_SEM_ALLOC, 0, &held);
+  store = dev->store;
+  if (!my_scull_in_range(store, end)) {
+    my_scull_sem_up(dev, MY_SCULL_SEM_ALLOC, held);
+    return -EFBIG;
+  }
+
+  while (pos < end) {
+    my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+    retval = -ENOMEM;
+    dataptr = my_scull_follow(store, item);
+    if (!dataptr)
+      break;
+    /* as for punch, so that re-chunking copies the new quantum too */
+    if (mutex_lock_interruptible(&dataptr->lock)) {
+      retval = -ERESTARTSYS;
+      break;
+    }
+    my_scull_touch(store, dataptr);
+    quantum_ptr = my_scull_fill(store, dataptr, s_pos);
+    mutex_unlock(&dataptr->lock);
+    if (!quantum_ptr)
+      break;
+    retval = 0;
+    pos += store->quantum - q_pos; /* on to the next quantum */
+    if (signal_pending(current)) {
+      retval = -ERESTARTSYS;
+      break;
+    }
+  }
+
+  /* grow over what we have, even if we didn't get it all */
+  if (pos > offset)
+    my_scull_grow(store, min(pos, end));
+  my_scull_sem_up(dev, MY_SCULL_SEM_ALLOC, held);
+  return retval;
+}
+
+/* see my_scull_store_punch */
+static int my_scull_punch(struct my_scull_dev *dev, loff_t offset, loff_t len)
+{
+  int retval = -EBUSY;
+  u64 held;
+
+  my_scull_sem_down(dev, MY_SCULL_SEM_ALLOC, 0, &held);
+  if (!atomic_read(&dev->vmas)) /* the mappings would keep the old pages */
+    retval = my_scull_store_punch(dev->store, offset, len);
+  my_scull_sem_up(dev, MY_SCULL_SEM_ALLOC, held);
+  return retval;
+}
+
+/* see my_scull_store_truncate */
+static int my_scull_truncate(struct my_scull_dev *dev, loff_t size)
+{
+  int retval = -EBUSY;
+  u64 held;
+
+  /* like trim, this wants the device to itself */
+  my_scull_sem_down(dev, MY_SCULL_SEM_TRIM, 0, &held);
+  if (!atomic_read(&dev->vmas))
+    retval = my_scull_store_truncate(dev->store, size);
+  my_scull_sem_up(dev, MY_SCULL_SEM_TRIM, held);
+  return retval;
+}
+
+/*
+ * Geometry. Each device has a quantum and qset of its own, starting
+ * from the module parameters. A new geometry takes effect when the
+ * device is next trimmed, or right away (in the background) if it is
+ * re-chunked.
+ */
+
+/* zero leaves that half of the geometry as it is */
+static int my_scull_set_geometry(struct my_scull_dev *dev, int quantum,
+                                 int qset)
+{
+  int retval = -EINVAL;
+  u64 held;
+
+  my_scull_sem_down(dev, MY_SCULL_SEM_GEOMETRY, 0, &held);
+  if (!quantum)
+    quantum = dev->quantum;
+  if (!qset)
+    qset = dev->qset;
+  if (my_scull_geometry_ok(quantum, qset)) {
+    dev->quantum = quantum;
+    dev->qset = qset;
+    retval = 0;
+  }
+  my_scull_sem_up(dev, MY_SCULL_SEM_GEOMETRY, held);
+  return retval;
+}
+
+/*
+ * Copy count bytes into an unpublished store, at pos. With from NULL,
+ * zero whatever is there already instead, allocating nothing.
+ */
+static int my_scull_copy_in(struct my_scull_store *store, loff_t pos,
+                            const void *from, size_t count)
+{
+  struct my_scull_qset *dataptr;
+  void *quantum_ptr;
+  unsigned long item;
+  int s_pos, q_pos;
+  size_t chunk;
+
+  my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+  while (count) {
+    chunk = min_t(size_t, count, store->quantum - q_pos);
+    if (from) {
+      dataptr = my_scull_follow(store, item);
+      if (!dataptr)
+        return -ENOMEM;
+      quantum_ptr = my_scull_fill(store, dataptr, s_pos);
+      if (!quantum_ptr)
+        return -ENOMEM;
+      memcpy(quantum_ptr + q_pos, from, chunk);
+      from += chunk;
+    } else {
+      dataptr = my_scull_lookup(store, item);
+      quantum_ptr = dataptr ? dataptr->data[s_pos] : NULL;
+      if (quantum_ptr)
+        memset(quantum_ptr + q_pos, 0, chunk);
+    }
+    count -= chunk;
+
+    q_pos = 0;
+    if (++s_pos == store->qset) {
+      s_pos = 0;
+      item++;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Copy a quantum set of old into store, at the same offsets. Its holes
+ * are zeroed in store, in case an earlier copy of it left data there.
+ * Whole quanta go, past the size or not: a writer may have filled them
+ * and not raised the size yet.
+ */
+static int my_scull_copy_qset(struct my_scull_store *store,
+                              struct my_scull_store *old,
+                              struct my_scull_qset *qs)
+{
+  loff_t start = my_scull_item_start(old, qs->item);
+  int i, retval;
+
+  qs->dirty = 0;
+  for (i = 0; i < old->qset; i++) {
+    if (!my_scull_in_range(store, start + old->quantum))
+      return -EFBIG;
+    retval = my_scull_copy_in(store, start, ACCESS_ONCE(qs->data[i]),
+                              old->quantum);
+    if (retval)
+      return retval;
+    start += old->quantum;
+  }
+  return 0;
+}
+
+/*
+ * Move the contents over to the device's geometry, in the background.
+ *
+ * This works like trim, only a new store is filled in before it is
+ * swapped in. The copy is made a quantum set at a time, each under the
+ * set's lock and dev->sem shared, so readers and writers carry on
+ * meanwhile, and trims and truncates get in between sets. Writers mark
+ * the quantum sets they change from then on (see my_scull_touch), and
+ * only the swap, which copies those again, has the device to itself.
+ * A trim or a shrinking truncate before then spoils the copy, and we
+ * give up. Mappings could change the data behind our back, so there
+ * may be none, and mmap waits until we are done.
+ *
+ * Holes are not copied, so they stay holes.
+ */
+static int my_scull_rechunk(struct my_scull_dev *dev)
+{
+  struct my_scull_store *old, *store;
+  struct my_scull_qset *qs;
+  unsigned long next = 0;
+  int retval, last = 0;
+  u64 held;
+
+  my_scull_sem_down(dev, MY_SCULL_SEM_RECHUNK, 0, &held);
+  old = dev->store;
+  if ((old->quantum == dev->quantum && old->qset == dev->qset) ||
+      cmpxchg(&old->rechunking, 0, 1)) {
+    my_scull_sem_up(dev, MY_SCULL_SEM_RECHUNK, held);
+    return 0; /* nothing to do, or it is being done already */
+  }
+  smp_mb(); /* set rechunking before looking for mappings, see my_scull_mmap */
+  retval = -EBUSY;
+  store = NULL;
+  if (!atomic_read(&dev->vmas)) {
+    retval = -ENOMEM;
+    store = my_scull_alloc_store(dev, dev->quantum, dev->qset);
+  }
+  if (!store) {
+    old->rechunking = 0;
+    my_scull_sem_up(dev, MY_SCULL_SEM_RECHUNK, held);
+    return retval;
+  }
+  atomic_inc(&old->refs); /* it must stay while we let go of dev->sem */
+  my_scull_sem_up(dev, MY_SCULL_SEM_RECHUNK, held);
+
+  /* copy what there is, a quantum set at a time */
+  while (!last) {
+    my_scull_sem_down(dev, MY_SCULL_SEM_RECHUNK, 0, &held);
+    retval = -EAGAIN;
+    if (dev->store != old || old->rechunk_spoilt) {
+      my_scull_sem_up(dev, MY_SCULL_SEM_RECHUNK, held);
+      goto out;
+    }
+    retval = 0;
+    qs = my_scull_next_qset(old, next);
+    if (qs) {
+      mutex_lock(&qs->lock);
+      retval = my_scull_copy_qset(store, old, qs);
+      mutex_unlock(&qs->lock);
+      last = qs->item == ULONG_MAX;
+      next = qs->item + 1;
+    }
+    my_scull_sem_up(dev, MY_SCULL_SEM_RECHUNK, held);
+    if (retval)
+      goto out;
+    if (!qs)
+      break;
+    cond_resched();
+  }
+
+  /* then swap it in, with whatever changed meanwhile copied again */
+  my_scull_sem_down(dev, MY_SCULL_SEM_GEOMETRY, 0, &held);
+  retval = -EAGAIN;
+  if (dev->store != old || old->rechunk_spoilt)
+    goto out_unlock;
+  retval = -EFBIG;
+  if (!my_scull_in_range(store, old->size))
+    goto out_unlock;
+  for (qs = my_scull_next_qset(old, 0); qs;
+       qs = my_scull_next_qset(old, qs->item + 1)) {
+    if (qs->dirty) {
+      retval = my_scull_copy_qset(store, old, qs);
+      if (retval)
+        goto out_unlock;
+    }
+    if (qs->item == ULONG_MAX)
+      break;
+  }
+
+  my_scull_set_size(store, old->size);
+  rcu_assign_pointer(dev->store, store);
+  my_scull_put_store(old); /* the device's reference */
+  store = NULL;
+  retval = 0;
+
+ out_unlock:
+  my_scull_sem_up(dev, MY_SCULL_SEM_GEOMETRY, held);
+ out:
+  old->rechunking = 0;
+  if (store)
+    my_scull_free_store(store); /* nobody has seen it */
+  my_scull_put_store(old);
+  return retval;
+}
+
+static void my_scull_rechunk_work(struct work_struct *work)
+{
+  struct my_scull_dev *dev =
+    container_of(work, struct my_scull_dev, rechunk_work);
+  int err;
+
+  err = my_scull_rechunk(dev);
+  if (err)
+    printk(KERN_NOTICE "my_scull%i: re-chunking failed, error %i\n",
+           (int) (dev - scull_devices), err);
+}
+
+/*
+ * Finding the data, as a sparse file would. Before 3.1 the VFS turns
+ * away any whence past SEEK_END before llseek sees it, so SEEK_DATA
+ * and SEEK_HOLE come in through the SEEKDATA and SEEKHOLE ioctls; on
+ * kernels that know them, llseek takes them too.
+ */
+
+/*
+ * Find the first data (or the first hole) at or after pos. Only the
+ * index is walked: list items that were never allocated are skipped
+ * whole, so the cost follows what is stored, not how big the device
+ * looks. Past the last of the data, the end of the device counts as a
+ * hole.
+ */
+static loff_t my_scull_seek_data(struct my_scull_store *store, loff_t pos,
+                                 loff_t size, int hole)
+{
+  struct my_scull_qset *qs;
+  void **data;
+  unsigned long item;
+  int s_pos, q_pos, present;
+
+  my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+
+  while (pos < size) {
+    qs = my_scull_next_qset(store, item);
+    if (!qs || qs->item != item) {
+      if (hole)
+        return pos; /* the whole list item is missing */
+      if (!qs)
+        break;
+      item = qs->item; /* jump to the next one there is */
+      s_pos = 0;
+      pos = my_scull_item_start(store, item);
+      continue;
+    }
+
+    data = qs->data;
+    for (; s_pos < store->qset && pos < size; s_pos++) {
+      present = srcu_dereference(data[s_pos], &store->dev->srcu) != NULL;
+      if (present == !hole)
+        return pos;
+      pos = my_scull_item_start(store, item) + (loff_t) (s_pos + 1) * store->quantum;
+    }
+    item++;
+    s_pos = 0;
+  }
+  return hole ? size : -ENXIO;
+}
+
+/* the same, on whatever the device holds now; -ENXIO at or past the end */
+static loff_t my_scull_find_data(struct my_scull_dev *dev, loff_t off,
+                                 int hole)
+{
+  struct my_scull_store *store;
+  loff_t newpos = -ENXIO, size;
+  int idx;
+
+  idx = srcu_read_lock(&dev->srcu);
+  store = srcu_dereference(dev->store, &dev->srcu);
+  size = my_scull_size(store);
+  if (off >= 0 && off < size)
+    newpos = my_scull_seek_data(store, off, size, hole);
+  srcu_read_unlock(&dev->srcu, idx);
+  return newpos;
+}
+
+/*
+ * The llseek method
+ */
+loff_t my_scull_llseek(struct file *filp, loff_t off, int whence)
+{
+  struct my_scull_dev *dev = filp->private_data;
+  loff_t newpos;
+  int idx;
+
+  switch(whence) {
+    case 0: /* SEEK_SET */
+      newpos = off;
+      break;
+
+    case 1: /* SEEK_CUR */
+      newpos = filp->f_pos + off;
+      break;
+
+    case 2: /* SEEK_END */
+      idx = srcu_read_lock(&dev->srcu);
+      newpos = my_scull_size(srcu_dereference(dev->store, &dev->srcu)) + off;
+      srcu_read_unlock(&dev->srcu, idx);
+      break;
+
+#ifdef SEEK_DATA
+    case SEEK_DATA:
+    case SEEK_HOLE:
+      newpos = my_scull_find_data(dev, off, whence == SEEK_HOLE);
+      if (newpos < 0)
+        return newpos;
+      break;
+#endif
+
+    default: /* can't happen */
+      newpos = -EINVAL;
+  }
+
+  if (newpos < 0)
+    return -EINVAL;
+  filp->f_pos = newpos;
+  return newpos;
+}
+
+/*
+ * The ioctl() implementation
+ */
+
+long my_scull_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+  struct my_scull_dev *dev = filp->private_data;
+  struct my_scull_range range;
+  __u64 size;
+  loff_t pos;
+  int retval, tmp;
+
+  /*
+   * extract the type and number bitfields, and don't decode
+   * wrong cmds: return ENOTTY (inappropriate ioctl) before access_ok()
+   */
+  if (_IOC_TYPE(cmd) != MY_SCULL_IOC_MAGIC)
+    return -ENOTTY;
+  if (_IOC_NR(cmd) > MY_SCULL_IOC_MAXNR)
+    return -ENOTTY;
+
+  /* all but the queries change the device, as a write would */
+  if (!(_IOC_DIR(cmd) & _IOC_READ) && !(filp->f_mode & FMODE_WRITE))
+    return -EBADF;
+
+  switch(cmd) {
+
+    case MY_SCULL_IOCPREALLOC:
+    case MY_SCULL_IOCPUNCH:
+      if (copy_from_user(&range, (void __user *) arg, sizeof(range)))
+        return -EFAULT;
+      if ((loff_t) range.offset < 0 || (loff_t) range.len <= 0 ||
+          (loff_t) (range.offset + range.len) < 0)
+        return -EINVAL;
+      if (cmd == MY_SCULL_IOCPREALLOC)
+        return my_scull_prealloc(dev, range.offset, range.len);
+      return my_scull_punch(dev, range.offset, range.len);
+
+    case MY_SCULL_IOCTRUNCATE:
+      if (copy_from_user(&size, (void __user *) arg, sizeof(size)))
+        return -EFAULT;
+      if ((loff_t) size < 0)
+        return -EINVAL;
+      return my_scull_truncate(dev, size);
+
+    case MY_SCULL_IOCSQUANTUM: /* Set: arg points to the value */
+    case MY_SCULL_IOCSQSET:
+      retval = get_user(tmp, (int __user *) arg);
+      if (retval)
+        return retval;
+      if (tmp <= 0)
+        return -EINVAL;
+      if (cmd == MY_SCULL_IOCSQUANTUM)
+        return my_scull_set_geometry(dev, tmp, 0);
+      return my_scull_set_geometry(dev, 0, tmp);
+
+    case MY_SCULL_IOCGQUANTUM: /* Get: arg is pointer to result */
+      return put_user(dev->quantum, (int __user *) arg);
+
+    case MY_SCULL_IOCGQSET:
+      return put_user(dev->qset, (int __user *) arg);
+
+    case MY_SCULL_IOCSEEKDATA: /* Query: arg points to the offset, in and out */
+    case MY_SCULL_IOCSEEKHOLE:
+      if (copy_from_user(&size, (void __user *) arg, sizeof(size)))
+        return -EFAULT;
+      pos = my_scull_find_data(dev, size, cmd == MY_SCULL_IOCSEEKHOLE);
+      if (pos < 0)
+        return pos;
+      return put_user((__u64) pos, (__u64 __user *) arg);
+
+    case MY_SCULL_IOCRECHUNK:
+      if (atomic_read(&dev->vmas))
+        return -EBUSY;
+      queue_work(my_scull_wq, &dev->rechunk_work);
+      return 0;
+
+    default:  /* redundant, as cmd was checked against MAXNR */
+      return -ENOTTY;
+  }
+}
+
+/*
+ * splice, and sendfile which is built on it. Reading hands the quantum
+ * pages themselves to the pipe, with a reference taken on each, so a
+ * trim that happens meanwhile only drops the device's own reference.
+ * Pipe buffers are a page at most, so a quantum goes out page by page.
+ * Quanta that aren't whole pages live in slab memory, which can't go
+ * into a pipe, so they are copied out through read instead.
+ */
+
+static void my_scull_pipe_buf_release(struct pipe_inode_info *pipe,
+                                      struct pipe_buffer *buf)
+{
+  put_page(buf->page);
+}
+
+/* the pages are still the device's, nobody else may have them */
+static int my_scull_pipe_buf_steal(struct pipe_inode_info *pipe,
+                                   struct pipe_buffer *buf)
+{
+  return 1;
+}
+
+static const struct pipe_buf_operations my_scull_pipe_buf_ops = {
+  .can_merge = 0,
+  .map       = generic_pipe_buf_map,
+  .unmap     = generic_pipe_buf_unmap,
+  .confirm   = generic_pipe_buf_confirm,
+  .release   = my_scull_pipe_buf_release,
+  .steal     = my_scull_pipe_buf_steal,
+  .get       = generic_pipe_buf_get,
+};
+
+static void my_scull_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+  put_page(spd->pages[i]);
+}
+
+ssize_t my_scull_splice_read(struct file *filp, loff_t *ppos,
+                             struct pipe_inode_info *pipe, size_t len,
+                             unsigned int flags)
+{
+  struct my_scull_dev *dev = filp->private_data;
+  struct page *pages[PIPE_BUFFERS];
+  struct partial_page partial[PIPE_BUFFERS];
+  struct splice_pipe_desc spd = {
+    .pages       = pages,
+    .partial     = partial,
+    .flags       = flags,
+    .ops         = &my_scull_pipe_buf_ops,
+    .spd_release = my_scull_spd_release,
+  };
+  struct my_scull_store *store;
+  struct my_scull_qset *dataptr;
+  void **data = NULL;
+  void *quantum_ptr;
+  int quantum, qset;
+  unsigned long item;
+  int s_pos, q_pos;
+  loff_t size;
+  size_t chunk;
+  ssize_t retval;
+  int idx, looked = 0;
+
+  /* gather the pages the same way read does, lock free */
+  idx = srcu_read_lock(&dev->srcu);
+  store = srcu_dereference(dev->store, &dev->srcu);
+  if (!my_scull_page_quanta(store)) {
+    srcu_read_unlock(&dev->srcu, idx);
+    return default_file_splice_read(filp, ppos, pipe, len, flags);
+  }
+  quantum = store->quantum;
+  qset = store->qset;
+  size = my_scull_size(store);
+  smp_rmb();
+
+  if (*ppos >= size) {
+    srcu_read_unlock(&dev->srcu, idx);
+    return 0;
+  }
+  if (*ppos + len > size)
+    len = size - *ppos;
+
+  my_scull_decode(store, *ppos, &item, &s_pos, &q_pos);
+
+  while (len && spd.nr_pages < PIPE_BUFFERS) {
+    if (!looked) {
+      dataptr = my_scull_lookup(store, item);
+      data = dataptr ? dataptr->data : NULL;
+      looked = 1;
+    }
+    quantum_ptr = data ? srcu_dereference(data[s_pos], &dev->srcu) : NULL;
+
+    /* up to the end of this page, quanta always start on one */
+    chunk = min_t(size_t, len, quantum - q_pos);
+    chunk = min_t(size_t, chunk, PAGE_SIZE - (q_pos & ~PAGE_MASK));
+    if (quantum_ptr)
+      pages[spd.nr_pages] = virt_to_page(quantum_ptr + q_pos);
+    else
+      pages[spd.nr_pages] = ZERO_PAGE(0); /* a hole */
+    get_page(pages[spd.nr_pages]);
+    partial[spd.nr_pages].offset = q_pos & ~PAGE_MASK;
+    partial[spd.nr_pages].len = chunk;
+    spd.nr_pages++;
+    len -= chunk;
+
+    q_pos += chunk;
+    if (q_pos == quantum) {
+      q_pos = 0;
+      if (++s_pos == qset) {
+        s_pos = 0;
+        item++;
+        looked = 0;
+      }
+    }
+  }
+  srcu_read_unlock(&dev->srcu, idx); /* the pages are held on their own now */
+
+  if (!spd.nr_pages)
+    return 0;
+  retval = splice_to_pipe(pipe, &spd);
+  if (retval > 0) {
+    *ppos += retval;
+    MY_SCULL_STAT_ADD(dev, read_bytes, retval);
+  }
+  MY_SCULL_STAT_INC(dev, reads);
+  return retval;
+}
+
+/*
+ * Take a whole page out of the pipe and make it the quantum, without
+ * copying. That only works for single-page quanta, a page that lands
+ * exactly on one that isn't there yet, and a page its owner gave up
+ * (SPLICE_F_MOVE, and the buffer agrees to be stolen). Returns zero if
+ * the page was taken.
+ */
+static int my_scull_splice_steal(struct my_scull_dev *dev,
+                                 struct pipe_inode_info *pipe,
+                                 struct pipe_buffer *buf, loff_t pos)
+{
+  struct my_scull_store *store;
+  struct my_scull_qset *dataptr;
+  void **data;
+  unsigned long item;
+  int s_pos, q_pos, retval = 1;
+  u64 held;
+
+  /* not worth waiting for, the page can always be copied instead */
+  if (my_scull_sem_down(dev, MY_SCULL_SEM_WRITE, 1, &held))
+    return 1;
+  store = dev->store;
+  if (store->quantum != PAGE_SIZE || PageHighMem(buf->page) ||
+      !my_scull_in_range(store, pos + PAGE_SIZE))
+    goto out;
+
+  my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+  dataptr = my_scull_follow(store, item);
+  if (!dataptr)
+    goto out;
+  if (!mutex_trylock(&dataptr->lock))
+    goto out;
+  my_scull_touch(store, dataptr);
+
+  data = dataptr->data;
+  if (!data[s_pos] && !buf->ops->steal(pipe, buf)) {
+    /* the page is ours, and locked; the pipe still drops its reference */
+    unlock_page(buf->page);
+    get_page(buf->page);
+    if (cmpxchg(&data[s_pos], NULL, page_address(buf->page))) {
+      put_page(buf->page); /* a fault got there first, copy after all */
+    } else {
+      atomic_inc(&store->nr_quanta);
+      retval = 0;
+    }
+  }
+  mutex_unlock(&dataptr->lock);
+
+  if (!retval) {
+    my_scull_grow(store, pos + PAGE_SIZE);
+    MY_SCULL_STAT_INC(dev, writes);
+    MY_SCULL_STAT_ADD(dev, write_bytes, PAGE_SIZE);
+  }
+ out:
+  my_scull_sem_up(dev, MY_SCULL_SEM_WRITE, held);
+  return retval;
+}
+
+static int my_scull_splice_actor(struct pipe_inode_info *pipe,
+                                 struct pipe_buffer *buf,
+                                 struct splice_desc *sd)
+{
+  struct my_scull_dev *dev = sd->u.file->private_data;
+  struct iovec iov;
+  mm_segment_t old_fs;
+  loff_t pos = sd->pos;
+  ssize_t retval;
+  char *src;
+
+  if ((sd->flags & SPLICE_F_MOVE) && !buf->offset && sd->len == PAGE_SIZE &&
+      !(pos & ~PAGE_MASK) && !my_scull_splice_steal(dev, pipe, buf, pos))
+    return sd->len;
+
+  /* everything else is copied in, through the same path as write */
+  src = buf->ops->map(pipe, buf, 0);
+  iov.iov_base = (void __user *) (src + buf->offset);
+  iov.iov_len = sd->len;
+  old_fs = get_fs();
+  set_fs(get_ds());
+  retval = my_scull_do_write(dev, &iov, 1, &pos,
+                             (sd->flags & SPLICE_F_NONBLOCK) ||
+                             (sd->u.file->f_flags & O_NONBLOCK));
+  set_fs(old_fs);
+  buf->ops->unmap(pipe, buf, src);
+  return retval;
+}
+
+ssize_t my_scull_splice_write(struct pipe_inode_info *pipe, struct file *filp,
+                              loff_t *ppos, size_t len, unsigned int flags)
+{
+  struct splice_desc sd = {
+    .total_len = len,
+    .flags     = flags,
+    .pos       = *ppos,
+    .u.file    = filp,
+  };
+  ssize_t retval;
+
+  pipe_lock(pipe);
+  retval = __splice_from_pipe(pipe, &sd, my_scull_splice_actor);
+  pipe_unlock(pipe);
+  if (retval > 0)
+    *ppos = sd.pos;
+  return retval;
+}
+
+/*
+ * The mmap implementation. Pages are faulted in one at a time; the
+ * open and close methods only keep count of the mappings, so that the
+ * device is not trimmed from under them.
+ */
+
+static void my_scull_vma_open(struct vm_area_struct *vma)
+{
+  struct my_scull_dev *dev = vma->vm_private_data;
+
+  atomic_inc(&dev->vmas);
+}
+
+static void my_scull_vma_close(struct vm_area_struct *vma)
+{
+  struct my_scull_dev *dev = vma->vm_private_data;
+
+  atomic_dec(&dev->vmas);
+}
+
+/*
+ * Find the page backing this part of the device. Holes are filled in
+ * if the mapping is shared and can be made writable, as any access to
+ * such a page may end up storing through it. Everywhere else they get
+ * the zero page, which a private mapping will copy on write.
+ */
+static int my_scull_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+  struct my_scull_dev *dev = vma->vm_private_data;
+  struct my_scull_store *store;
+  struct my_scull_qset *dataptr;
+  void *quantum_ptr = NULL;
+  loff_t offset = (loff_t) vmf->pgoff << PAGE_SHIFT;
+  unsigned long item;
+  int quantum, s_pos, q_pos;
+  int alloc = (vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE);
+  struct page *page;
+  int retval = VM_FAULT_SIGBUS;
+  int idx;
+
+  /*
+   * Like a reader, we take no lock: we may have faulted in the middle
+   * of a write() that holds one. Filling in a hole is lock free anyway.
+   */
+  idx = srcu_read_lock(&dev->srcu);
+  store = srcu_dereference(dev->store, &dev->srcu);
+  quantum = store->quantum;
+  if (offset >= my_scull_size(store) || quantum % PAGE_SIZE)
+    goto out; /* out of range, or trimmed to a geometry we can't map */
+
+  my_scull_decode(store, offset, &item, &s_pos, &q_pos);
+
+  if (alloc) {
+    retval = VM_FAULT_OOM;
+    dataptr = my_scull_follow(store, item);
+    if (!dataptr)
+      goto out;
+    quantum_ptr = my_scull_fill(store, dataptr, s_pos);
+    if (!quantum_ptr)
+      goto out;
+  } else {
+    dataptr = my_scull_lookup(store, item);
+    if (dataptr)
+      quantum_ptr = srcu_dereference(dataptr->data[s_pos], &dev->srcu);
+  }
+
+  if (quantum_ptr)
+    page = virt_to_page(quantum_ptr + q_pos);
+  else
+    page = ZERO_PAGE(vmf->virtual_address);
+
+  get_page(page);
+  vmf->page = page;
+  retval = 0;
+
+ out:
+  srcu_read_unlock(&dev->srcu, idx);
+  return retval;
+}
+
+static const struct vm_operations_struct my_scull_vm_ops = {
+  .open  = my_scull_vma_open,
+  .close = my_scull_vma_close,
+  .fault = my_scull_vma_fault,
+};
+
+int my_scull_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+  struct my_scull_dev *dev = filp->private_data;
+  struct my_scull_store *store;
+  int idx, retval = 0;
+
+  /*
+   * Count the mapping before looking at the store: re-chunking sets
+   * rechunking before it looks for mappings, so one of us sees the
+   * other.
+   */
+  atomic_inc(&dev->vmas);
+  smp_mb__after_atomic_inc();
+
+  /*
+   * Not dev->sem: we are called with mmap_sem held, which a writer
+   * faulting in copy_from_user wants while holding dev->sem. A trim
+   * may change the geometry right after we look; the fault method
+   * checks it again.
+   */
+  idx = srcu_read_lock(&dev->srcu);
+  store = srcu_dereference(dev->store, &dev->srcu);
+  if (store->quantum % PAGE_SIZE)
+    retval = -ENODEV; /* a quantum that isn't made of whole pages can't be mapped */
+  else if (ACCESS_ONCE(store->rechunking))
+    retval = -EBUSY; /* stores through the mapping wouldn't be copied */
+  srcu_read_unlock(&dev->srcu, idx);
+  if (retval) {
+    atomic_dec(&dev->vmas);
+    return retval;
+  }
+
+  /* don't do anything here: the fault method fills the page tables */
+  vma->vm_ops = &my_scull_vm_ops;
+  vma->vm_flags |= VM_RESERVED;
+  vma->vm_private_data = dev;
+  return 0;
+}
+
+/*
+ * Initialize file operations
+ */
+static const struct file_operations my_scull_fops = {
+  .owner   = THIS_MODULE,
+  .llseek  = my_scull_llseek,
+  .open    = my_scull_open,
+  .release = my_scull_release,
+  .read    = my_scull_read,
+  .write   = my_scull_write,
+  .aio_read  = my_scull_aio_read,
+  .aio_write = my_scull_aio_write,
+  .splice_read  = my_scull_splice_read,
+  .splice_write = my_scull_splice_write,
+  .unlocked_ioctl = my_scull_ioctl,
+  .compat_ioctl   = my_scull_ioctl, /* the arguments look the same */
+  .mmap    = my_scull_mmap,
+};
+
+/*
+ * sysfs: /sys/class/my_scull/my_scullN/{quantum,qset,rechunk}, the
+ * same knobs as the geometry ioctls, and stats/ with the counters.
+ */
+static struct class *my_scull_class;
+
+static ssize_t my_scull_quantum_show(struct device *d,
+                                     struct device_attribute *attr, char *buf)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+
+  return sprintf(buf, "%i\n", dev->quantum);
+}
+
+static ssize_t my_scull_qset_show(struct device *d,
+                                  struct device_attribute *attr, char *buf)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+
+  return sprintf(buf, "%i\n", dev->qset);
+}
+
+static ssize_t my_scull_geometry_store(struct device *d,
+                                       struct device_attribute *attr,
+                                       const char *buf, size_t count)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+  unsigned long val;
+  int retval;
+
+  if (strict_strtoul(buf, 0, &val) || !val || val > INT_MAX)
+    return -EINVAL;
+  if (!strcmp(attr->attr.name, "quantum"))
+    retval = my_scull_set_geometry(dev, val, 0);
+  else
+    retval = my_scull_set_geometry(dev, 0, val);
+  return retval ? retval : count;
+}
+
+/* any write starts re-chunking to the geometry set above */
+static ssize_t my_scull_rechunk_store(struct device *d,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+
+  if (atomic_read(&dev->vmas))
+    return -EBUSY;
+  queue_work(my_scull_wq, &dev->rechunk_work);
+  return count;
+}
+
+/*
+ * The statistics, one file each under stats/, summed over all CPUs
+ */
+struct my_scull_stat_attr {
+  struct device_attribute attr;
+  size_t offset;              /* of the counter in struct my_scull_stats */
+};
+
+static ssize_t my_scull_stat_show(struct device *d,
+                                  struct device_attribute *attr, char *buf)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+  size_t offset = container_of(attr, struct my_scull_stat_attr, attr)->offset;
+  u64 sum = 0;
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+    sum += *(u64 *) ((char *) per_cpu_ptr(dev->stats, cpu) + offset);
+  return sprintf(buf, "%llu\n", (unsigned long long) sum);
+}
+
+/*
+ * A histogram is shown a line per bucket that has anything in it:
+ * the bucket's lower bound in nanoseconds, then the count.
+ */
+static ssize_t my_scull_hist_show(struct device *d,
+                                  struct device_attribute *attr, char *buf)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+  size_t offset = container_of(attr, struct my_scull_stat_attr, attr)->offset;
+  u64 sum;
+  int b, cpu, len = 0;
+
+  for (b = 0; b < MY_SCULL_HIST_BUCKETS; b++) {
+    sum = 0;
+    for_each_possible_cpu(cpu)
+      sum += ((u64 *) ((char *) per_cpu_ptr(dev->stats, cpu) + offset))[b];
+    if (sum)
+      len += sprintf(buf + len, "%llu %llu\n",
+                     b ? 1ULL << (b - 1) : 0ULL, (unsigned long long) sum);
+  }
+  return len;
+}
+
+/*
+ * stats/sem is the lock profile of dev->sem, a line per user: times
+ * acquired, times found taken, then total and longest wait and hold
+ * in nanoseconds. Writing anything to it starts it over. It only
+ * counts while stats/sem_enable is 1; it is 0 at load, since the
+ * profile reads the clock on every acquisition.
+ */
+static ssize_t my_scull_sem_show(struct device *d,
+                                 struct device_attribute *attr, char *buf)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+  struct my_scull_sem_prof sum, *prof;
+  int user, cpu, len;
+
+  len = sprintf(buf, "%-10s %10s %10s %14s %12s %14s %12s\n", "user",
+                "acquired", "contended", "wait_ns", "wait_max", "hold_ns",
+                "hold_max");
+  for (user = 0; user < MY_SCULL_SEM_NR; user++) {
+    memset(&sum, 0, sizeof(sum));
+    for_each_possible_cpu(cpu) {
+      prof = &per_cpu_ptr(dev->stats, cpu)->sem[user];
+      sum.acquired += prof->acquired;
+      sum.contended += prof->contended;
+      sum.wait_ns += prof->wait_ns;
+      sum.wait_max_ns = max(sum.wait_max_ns, prof->wait_max_ns);
+      sum.hold_ns += prof->hold_ns;
+      sum.hold_max_ns = max(sum.hold_max_ns, prof->hold_max_ns);
+    }
+    len += sprintf(buf + len, "%-10s %10llu %10llu %14llu %12llu %14llu %12llu\n",
+                   my_scull_sem_users[user].name,
+                   (unsigned long long) sum.acquired,
+                   (unsigned long long) sum.contended,
+                   (unsigned long long) sum.wait_ns,
+                   (unsigned long long) sum.wait_max_ns,
+                   (unsigned long long) sum.hold_ns,
+                   (unsigned long long) sum.hold_max_ns);
+  }
+  return len;
+}
+
+/*
+ * This races with the CPUs still counting, so a count or two may
+ * survive the reset. That's fine for what it is used for.
+ */
+static ssize_t my_scull_sem_reset(struct device *d,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+    memset(per_cpu_ptr(dev->stats, cpu)->sem, 0,
+           sizeof(dev->stats->sem));
+  return count;
+}
+
+static ssize_t my_scull_sem_enable_show(struct device *d,
+                                        struct device_attribute *attr,
+                                        char *buf)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+
+  return sprintf(buf, "%i\n", dev->sem_prof);
+}
+
+static ssize_t my_scull_sem_enable_store(struct device *d,
+                                         struct device_attribute *attr,
+                                         const char *buf, size_t count)
+{
+  struct my_scull_dev *dev = dev_get_drvdata(d);
+  unsigned long val;
+
+  if (strict_strtoul(buf, 0, &val) || val > 1)
+    return -EINVAL;
+  ACCESS_ONCE(dev->sem_prof) = val;
+  return count;
+}
+
+static struct device_attribute my_scull_sem_attr =
+  __ATTR(sem, S_IRUGO | S_IWUSR, my_scull_sem_show, my_scull_sem_reset);
+
+static struct device_attribute my_scull_sem_enable_attr =
+  __ATTR(sem_enable, S_IRUGO | S_IWUSR, my_scull_sem_enable_show,
+         my_scull_sem_enable_store);
+
+#define MY_SCULL_STAT_ATTR(name)                                    \
+  { __ATTR(name, S_IRUGO, my_scull_stat_show, NULL),                \
+    offsetof(struct my_scull_stats, name) }
+
+#define MY_SCULL_HIST_ATTR(name)                                    \
+  { __ATTR(name, S_IRUGO, my_scull_hist_show, NULL),                \
+    offsetof(struct my_scull_stats, name) }
+
+static struct my_scull_stat_attr my_scull_stat_attrs[] = {
+  MY_SCULL_STAT_ATTR(reads),
+  MY_SCULL_STAT_ATTR(writes),
+  MY_SCULL_STAT_ATTR(read_bytes),
+  MY_SCULL_STAT_ATTR(write_bytes),
+  MY_SCULL_STAT_ATTR(allocs),
+  MY_SCULL_STAT_ATTR(alloc_fails),
+  MY_SCULL_STAT_ATTR(trims),
+  MY_SCULL_STAT_ATTR(lock_waits),
+  MY_SCULL_HIST_ATTR(read_ns),
+  MY_SCULL_HIST_ATTR(write_ns),
+  MY_SCULL_HIST_ATTR(sem_wait_ns),
+};
+
+static struct attribute *my_scull_stat_group_attrs[] = {
+  &my_scull_stat_attrs[0].attr.attr,
+  &my_scull_stat_attrs[1].attr.attr,
+  &my_scull_stat_attrs[2].attr.attr,
+  &my_scull_stat_attrs[3].attr.attr,
+  &my_scull_stat_attrs[4].attr.attr,
+  &my_scull_stat_attrs[5].attr.attr,
+  &my_scull_stat_attrs[6].attr.attr,
+  &my_scull_stat_attrs[7].attr.attr,
+  &my_scull_stat_attrs[8].attr.attr,
+  &my_scull_stat_attrs[9].attr.attr,
+  &my_scull_stat_attrs[10].attr.attr,
+  &my_scull_sem_attr.attr,
+  &my_scull_sem_enable_attr.attr,
+  NULL,
+};
+
+static struct attribute_group my_scull_stat_group = {
+  .name  = "stats",
+  .attrs = my_scull_stat_group_attrs,
+};
+
+static struct device_attribute my_scull_dev_attrs[] = {
+  __ATTR(quantum, S_IRUGO | S_IWUSR, my_scull_quantum_show,
+         my_scull_geometry_store),
+  __ATTR(qset, S_IRUGO | S_IWUSR, my_scull_qset_show,
+         my_scull_geometry_store),
+  __ATTR(rechunk, S_IWUSR, NULL, my_scull_rechunk_store),
+};
+
+static void my_scull_create_sysfs(struct my_scull_dev *dev, int index)
+{
+  struct device *d;
+  int i;
+
+  d = device_create(my_scull_class, NULL,
+                    MKDEV(my_scull_major, my_scull_minor + index), dev,
+                    "my_scull%d", index);
+  if (IS_ERR(d)) {
+    printk(KERN_NOTICE "Error %li creating my_scull%d in sysfs\n",
+           PTR_ERR(d), index);
+    return;
+  }
+  for (i = 0; i < ARRAY_SIZE(my_scull_dev_attrs); i++)
+    if (device_create_file(d, &my_scull_dev_attrs[i]))
+      printk(KERN_NOTICE "Error adding %s to my_scull%d in sysfs\n",
+             my_scull_dev_attrs[i].attr.name, index);
+  if (sysfs_create_group(&d->kobj, &my_scull_stat_group))
+    printk(KERN_NOTICE "Error adding stats to my_scull%d in sysfs\n", index);
+}
+
+/*
+ * The cleanup function is used to handle initialization failures as well.
+ * Therefore, it must be careful to work correctly even if some the items
+ * have not been initialized
+ */
+
+static void __exit my_scull_cleanup_module(void)
+{
+  int i, cpu = -1;
+  dev_t devno = MKDEV(my_scull_major, my_scull_minor);
+
+#ifdef MY_SCULL_DEBUG /* use proc only if debugging */
+  my_scull_remove_proc();
+#endif
+
+  if (scull_devices) {
+    /* nobody can get at the devices once their cdevs are gone */
+    for (i = 0; i < my_scull_nr_devs; i++) {
+      if (!scull_devices[i].store) /* initialization didn't get this far */
+        continue;
+      if (my_scull_class)
+        device_destroy(my_scull_class,
+                       MKDEV(my_scull_major, my_scull_minor + i));
+      cdev_del(&scull_devices[i].cdev);
+    }
+
+    /*
+     * Let any re-chunking finish before the stores are taken away, and
+     * any reaping, which leaves each store with just the device's
+     * reference.
+     */
+    flush_workqueue(my_scull_wq);
+
+    /*
+     * Free the devices' contents in parallel: hand each store to the
+     * queue's thread on the next online CPU, and wait for all of them
+     * (and for any trims still pending) together.
+     */
+    get_online_cpus();
+    for (i = 0; i < my_scull_nr_devs; i++) {
+      if (!scull_devices[i].store)
+        continue;
+      cpu = cpumask_next(cpu, cpu_online_mask);
+      if (cpu >= nr_cpu_ids)
+        cpu = cpumask_first(cpu_online_mask);
+      queue_work_on(cpu, my_scull_wq, &scull_devices[i].store->free_work);
+    }
+    put_online_cpus();
+  }
+  if (my_scull_wq)
+    destroy_workqueue(my_scull_wq); /* flushes it first */
+
+  if (scull_devices) {
+    for (i = 0; i < my_scull_nr_devs; i++)
+      if (scull_devices[i].store) {
+        cleanup_srcu_struct(&scull_devices[i].srcu);
+        free_percpu(scull_devices[i].stats);
+      }
+    kfree(scull_devices);
+  }
+  if (my_scull_class)
+    class_destroy(my_scull_class);
+  my_scull_store_exit();
+
+  /* and call the cleanup functions for friend devices */
+  my_scull_p_cleanup();
+
+  // Free device numbers since they are no longer in use
+  unregister_chrdev_region(devno, my_scull_nr_devs);
+  PDEBUG("goodbye!. %s:%i\n", __FILE__, __LINE__);
+}
+
+/*
+ * Set up the char_dev structure for this device
+ */
+static void my_scull_setup_cdev(struct my_scull_dev *dev, int index)
+{
+  int err, devno = MKDEV(my_scull_major, my_scull_minor + index);
+
+  cdev_init(&dev->cdev, &my_scull_fops);
+  dev->cdev.owner = THIS_MODULE;
+  dev->cdev.ops = &my_scull_fops;
+  err = cdev_add(&dev->cdev, devno, 1);
+  /* Fail gracefully if need be */
+  if (err)
+    PDEBUG("error %d adding scull %d. %s:%i\n", err, index, __FILE__, __LINE__);
+}
+
+static int __init my_scull_init_module(void)
+{
+  int   result, i;
+  dev_t dev = 0;
+
+  if (!my_scull_geometry_ok(my_scull_quantum, my_scull_qset)) {
+    printk(KERN_WARNING "my_scull: bad geometry, quantum %i qset %i\n",
+           my_scull_quantum, my_scull_qset);
+    return -EINVAL;
+  }
+
+  /*
+   * Get a range of minor numbers to work with.
+   * my_scull_major is set to 0 but can be assigned another value at load
+   * time via a parameter. Therefore by default we ask for a dynamic major
+   * unless directed otherwise at load time.
+   */
+  if (my_scull_major) {
+    dev = MKDEV(my_scull_major, my_scull_minor);
+    result = register_chrdev_region(dev, my_scull_nr_devs, "my_scull");
+  } else {
+    result = alloc_chrdev_region(&dev, my_scull_minor, my_scull_nr_devs,
+                                 "my_scull");
+    my_scull_major = MAJOR(dev);
+  }
+  if (result < 0) {
+    PDEBUG("can't get major %d. %s:%i\n", my_scull_major, __FILE__, __LINE__);
+    return result;
+  }
+
+  /* the caches must be there before any device can allocate from them */
+  result = my_scull_store_init(my_scull_qset);
+  if (result)
+    goto fail;
+  my_scull_wq = create_workqueue("my_scull");
+  if (!my_scull_wq) {
+    result = -ENOMEM;
+    goto fail;
+  }
+
+  my_scull_class = class_create(THIS_MODULE, "my_scull");
+  if (IS_ERR(my_scull_class)) {
+    result = PTR_ERR(my_scull_class);
+    my_scull_class = NULL;
+    goto fail;
+  }
+
+  /*
+   * Allocate the devices - we can't have them static, i.e., as an array, as
+   * the number can be specified at load time
+   */
+  scull_devices = kmalloc(my_scull_nr_devs * sizeof(struct my_scull_dev), GFP_KERNEL);
+  if (!scull_devices) {
+    result = -ENOMEM;
+    goto fail;
+  }
+  memset(scull_devices, 0, my_scull_nr_devs * sizeof(struct my_scull_dev));
+
+  for (i = 0; i < my_scull_nr_devs; i++) {
+    /*
+     * must be initialized before device is made available to rest of the system
+     * to avaoid a race condition where the semaphore could be accessed before it's ready
+     */
+    init_rwsem(&scull_devices[i].sem);
+    INIT_WORK(&scull_devices[i].rechunk_work, my_scull_rechunk_work);
+    scull_devices[i].quantum = my_scull_quantum;
+    scull_devices[i].qset = my_scull_qset;
+    result = init_srcu_struct(&scull_devices[i].srcu);
+    if (result)
+      goto fail;
+    scull_devices[i].stats = alloc_percpu(struct my_scull_stats);
+    if (scull_devices[i].stats)
+      scull_devices[i].store = my_scull_alloc_store(&scull_devices[i],
+                                                    my_scull_quantum,
+                                                    my_scull_qset);
+    if (!scull_devices[i].store) {
+      free_percpu(scull_devices[i].stats);
+      cleanup_srcu_struct(&scull_devices[i].srcu);
+      result = -ENOMEM;
+      goto fail;
+    }
+
+    my_scull_setup_cdev(&scull_devices[i], i);
+    my_scull_create_sysfs(&scull_devices[i], i);
+  }
+
+  /* At this point call the init function for any friend device */
+  dev = MKDEV(my_scull_major, my_scull_minor + my_scull_nr_devs);
+  dev += my_scull_p_init(dev);
+
+  PDEBUG("hello! %s:%i\n", __FILE__, __LINE__);
+
+#ifdef MY_SCULL_DEBUG /* only when debugging */
+  my_scull_create_proc();
+#endif
+
+  return 0; /* succeed */
+
+ fail:
+  my_scull_cleanup_module();
+  return result;
+}
+
+module_init(my_scull_init_module);
+module_exit(my_scull_cleanup_module);
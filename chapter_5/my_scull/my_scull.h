@@ -2,6 +2,8 @@
 #ifndef _MY_SCULL_H_
 #define _MY_SCULL_H_
 
+#include <linux/ioctl.h> /* needed for the _IOW etc stuff used later */
+
 /*
  * Macros to help debugging
  */
@@ -31,18 +33,24 @@
 #define MY_SCULL_NR_DEVS  4 /* number of devices, myscull0 through myscull3*/
 #endif
 
+#ifndef MY_SCULL_P_NR_DEVS
+#define MY_SCULL_P_NR_DEVS 4 /* my_scullpipe0 through my_scullpipe3 */
+#endif
+
 /*
  * The bare device is a variable-length region of memory.
- * Use a linked list of indirect blocks.
+ * Use an index of indirect blocks.
  *
- * "my_scull_dev->data" points to an array of pointers, each
+ * "my_scull_store->index" is a radix tree of quantum sets keyed by
+ * their list item number, i.e. the device offset divided by
+ * quantum * qset. Each quantum set ends in an array of pointers, each
  * pointer refers to a memory area of SCULL_QUANTUM bytes.
  *
  * The array (quantum-set) is SCULL_QSET long.
  */
 
 #ifndef MY_SCULL_QUANTUM
-#define MY_SCULL_QUANTUM  4000
+#define MY_SCULL_QUANTUM  PAGE_SIZE /* quanta are page allocations */
 #endif
 
 #ifndef MY_SCULL_QSET
@@ -50,38 +58,210 @@
 #endif
 
 /*
- * Representation of scull quantum sets
+ * The pipe device is a ring buffer between one reader and one writer.
+ * Its size is rounded up to a power of two.
+ */
+#ifndef MY_SCULL_P_BUFFER
+#define MY_SCULL_P_BUFFER 65536
+#endif
+
+/*
+ * Representation of scull quantum sets. The pointers to the quanta
+ * come right after the node, in the same allocation, so finding a
+ * quantum costs one pointer less to follow.
  */
 struct my_scull_qset {
-  void **data;
-  struct my_scull_qset *next;
+  unsigned long item;         /* our key in my_scull_store->index */
+  int dirty;                  /* changed since re-chunking copied it */
+  struct mutex lock;          /* serializes writers to this quantum set */
+  void *data[];               /* my_scull_store->qset of them */
 };
 
-struct my_scull_dev {
-  struct my_scull_qset *data; /* Pointer to first quantum set */
+/*
+ * What the device holds. Readers find it through my_scull_dev->store
+ * without taking any lock, so trimming the device swaps in a new, empty
+ * store rather than taking this one apart in place.
+ */
+struct my_scull_dev;
+
+struct my_scull_store {
+  struct radix_tree_root index; /* quantum sets, keyed by list item */
   int quantum;                /* the current quantum size */
+  struct kmem_cache *quantum_cache; /* for quanta that aren't whole pages */
   int qset;                   /* the current array size */
-  unsigned long size;         /* amount of data stored here */
-  struct semaphore sem;       /* mutual exclusion semaphore */
+  int pow2;                   /* both are powers of two, so decode with: */
+  int quantum_shift;          /* log2(quantum) */
+  int item_shift;             /* log2(quantum * qset) */
+  loff_t size;                /* amount of data stored here */
+  spinlock_t lock;            /* for changes to the index and the size */
+#if BITS_PER_LONG == 32
+  seqcount_t size_seq;        /* so lockless readers see all of the size */
+#endif
+  int rechunking;             /* being copied to a new geometry, see */
+  int rechunk_spoilt;         /* my_scull_rechunk in main.c */
+  atomic_t nr_qsets;          /* what we have allocated, for reporting */
+  atomic_t nr_quanta;
+  struct my_scull_dev *dev;   /* whose readers to wait for before freeing */
+  atomic_t refs;              /* the device's, and one per page of my_scull_reap */
+  struct work_struct free_work; /* frees us once the last of them is gone */
+};
+
+/*
+ * Counters, kept per CPU. See /sys/class/my_scull/my_scullN/stats/
+ *
+ * The latency histograms have a bucket per power of two nanoseconds,
+ * up to about a second.
+ */
+#define MY_SCULL_HIST_BUCKETS 32
+
+/*
+ * Everybody who takes my_scull_dev->sem gets a lock profile of their
+ * own, see stats/sem. Reads, mmap and the /proc files go by SRCU
+ * instead, so they aren't here.
+ */
+enum {
+  MY_SCULL_SEM_TRIM,          /* trim on open, TRUNCATE: exclusive */
+  MY_SCULL_SEM_GEOMETRY,      /* geometry changes, re-chunking's swap: exclusive */
+  MY_SCULL_SEM_WRITE,         /* write and splice_write: shared */
+  MY_SCULL_SEM_ALLOC,         /* PREALLOC and PUNCH: shared */
+  MY_SCULL_SEM_RECHUNK,       /* re-chunking's copy: shared */
+  MY_SCULL_SEM_NR
+};
+
+struct my_scull_sem_prof {
+  u64 acquired;
+  u64 contended;              /* found it taken, whether we then waited or not */
+  u64 wait_ns;                /* in all */
+  u64 wait_max_ns;
+  u64 hold_ns;
+  u64 hold_max_ns;
+};
+
+struct my_scull_stats {
+  u64 reads;                  /* read and splice_read calls */
+  u64 writes;                 /* write calls, and pages spliced in whole */
+  u64 read_bytes;
+  u64 write_bytes;
+  u64 allocs;                 /* quanta, pointer arrays and quantum sets */
+  u64 alloc_fails;
+  u64 trims;
+  u64 lock_waits;             /* waits for dev->sem or a quantum set */
+  u64 read_ns[MY_SCULL_HIST_BUCKETS];     /* how long reads took */
+  u64 write_ns[MY_SCULL_HIST_BUCKETS];    /* writes, waits included */
+  u64 sem_wait_ns[MY_SCULL_HIST_BUCKETS]; /* anyone's waits for dev->sem */
+  struct my_scull_sem_prof sem[MY_SCULL_SEM_NR];
+};
+
+/*
+ * Each CPU counts into its own copy, with no lock and no shared cache
+ * line; the copies are only added up when somebody reads them.
+ */
+#define MY_SCULL_STAT_ADD(dev, field, n) this_cpu_add((dev)->stats->field, (n))
+#define MY_SCULL_STAT_INC(dev, field)    MY_SCULL_STAT_ADD(dev, field, 1)
+
+struct my_scull_dev {
+  /* what every read and write looks at, and only a trim changes */
+  struct my_scull_store *store ____cacheline_aligned_in_smp; /* current contents, see my_scull_read */
+  struct my_scull_stats *stats; /* per CPU */
+  int sem_prof;               /* profile dev->sem per user, stats/sem_enable */
+  struct srcu_struct srcu;    /* how lockless readers hold on to a store */
+
+  /* every writer bounces this one around, keep it to itself */
+  struct rw_semaphore sem ____cacheline_aligned_in_smp; /* shared by writers, exclusive for trim */
+
+  /* the rest is hardly ever touched */
+  int quantum ____cacheline_aligned_in_smp; /* the geometry for the next store */
+  int qset;
+  struct work_struct rechunk_work; /* moves the data over to it */
+  atomic_t vmas;              /* active mappings */
   struct cdev cdev;           /* char device structure */
 };
 
+/* the device's number, to tell devices apart in traces */
+#define MY_SCULL_MINOR(d) MINOR((d)->cdev.dev)
+
 /*
  * The different configurable parameters
  * Defined in main.c
  */
 extern int my_scull_major;
 extern int my_scull_nr_devs;
+extern int my_scull_p_buffer; /* pipe.c */
 
 /*
  * Prototypes for shared functions
  */
+int     my_scull_p_init(dev_t dev);
+void    my_scull_p_cleanup(void);
+
 int     my_scull_open(struct inode *inode, struct file *filp);
 int     my_scull_release(struct inode *inode, struct file *filp);
 ssize_t my_scull_read(struct file *filp, char __user *buf, size_t count,
                       loff_t *fpos);
 ssize_t my_scull_write(struct file *filp, const char __user *buf, size_t count,
                        loff_t *f_pos);
+ssize_t my_scull_aio_read(struct kiocb *iocb, const struct iovec *iov,
+                          unsigned long nr_segs, loff_t pos);
+ssize_t my_scull_aio_write(struct kiocb *iocb, const struct iovec *iov,
+                           unsigned long nr_segs, loff_t pos);
+ssize_t my_scull_splice_read(struct file *filp, loff_t *ppos,
+                             struct pipe_inode_info *pipe, size_t len,
+                             unsigned int flags);
+ssize_t my_scull_splice_write(struct pipe_inode_info *pipe, struct file *filp,
+                              loff_t *ppos, size_t len, unsigned int flags);
+loff_t  my_scull_llseek(struct file *filp, loff_t off, int whence);
+long    my_scull_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int     my_scull_mmap(struct file *filp, struct vm_area_struct *vma);
 int     my_scull_trim(struct my_scull_dev *dev);
 
+/*
+ * Ioctl definitions
+ *
+ * fallocate and ftruncate are refused on a char device before they
+ * ever reach us, and so are SEEK_DATA and SEEK_HOLE before 3.1; their
+ * work is done through ioctls instead.
+ */
+
+/* Use 'k' as magic number */
+#define MY_SCULL_IOC_MAGIC  'k'
+
+/* a byte range of the device */
+struct my_scull_range {
+  __u64 offset;
+  __u64 len;
+};
+
+/*
+ * PREALLOC allocates every quantum in the range and extends the device
+ *          over it if need be, like fallocate
+ * PUNCH    frees the quanta in the range, which then read as zeros
+ * TRUNCATE sets the size, freeing whatever lies past it
+ */
+#define MY_SCULL_IOCPREALLOC  _IOW(MY_SCULL_IOC_MAGIC, 1, struct my_scull_range)
+#define MY_SCULL_IOCPUNCH     _IOW(MY_SCULL_IOC_MAGIC, 2, struct my_scull_range)
+#define MY_SCULL_IOCTRUNCATE  _IOW(MY_SCULL_IOC_MAGIC, 3, __u64)
+
+/*
+ * S means "Set" through a ptr,
+ * G means "Get": reply by setting through a pointer
+ *
+ * The geometry is per device. It applies from the next trim, or once
+ * RECHUNK has moved the existing data over to it in the background.
+ */
+#define MY_SCULL_IOCSQUANTUM  _IOW(MY_SCULL_IOC_MAGIC, 4, int)
+#define MY_SCULL_IOCSQSET     _IOW(MY_SCULL_IOC_MAGIC, 5, int)
+#define MY_SCULL_IOCGQUANTUM  _IOR(MY_SCULL_IOC_MAGIC, 6, int)
+#define MY_SCULL_IOCGQSET     _IOR(MY_SCULL_IOC_MAGIC, 7, int)
+#define MY_SCULL_IOCRECHUNK   _IO(MY_SCULL_IOC_MAGIC, 8)
+
+/*
+ * SEEKDATA and SEEKHOLE take an offset and hand back the next data (or
+ * hole) at or after it, as lseek's SEEK_DATA and SEEK_HOLE would. The
+ * file position is left alone; -ENXIO means there is nothing past it.
+ */
+#define MY_SCULL_IOCSEEKDATA  _IOWR(MY_SCULL_IOC_MAGIC, 9, __u64)
+#define MY_SCULL_IOCSEEKHOLE  _IOWR(MY_SCULL_IOC_MAGIC, 10, __u64)
+
+#define MY_SCULL_IOC_MAXNR 10
+
 #endif /* _MY_SCULL_H_ */
@@ -0,0 +1,340 @@
+/*
+ * my_scull_bench.c -- throughput and latency of the my_scull devices
+ *
+ * Runs a workload against one or more of /dev/my_scull[0-3] from any
+ * number of threads, and prints one line of JSON with the results so
+ * that runs can be compared with a baseline by a script.
+ *
+ * Each thread works on a region of its own, "span" bytes long, in the
+ * device it is given (threads go round the devices in turn). Blocks
+ * are taken one after another, or at random with -r, and each one is
+ * read or written as -w decides. Anything to be read is written once
+ * before the clock starts.
+ *
+ * Build with "make bench", then for example
+ *
+ *   ./my_scull_bench -d /dev/my_scull0,/dev/my_scull1 -t 8 -b 4k -r -w 10
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+struct bench_opts {
+  char **devs;                /* device names, and how many */
+  int ndevs;
+  int threads;
+  size_t block;               /* bytes per read or write */
+  unsigned long long span;    /* bytes of the device per thread */
+  int write_pct;              /* percent of the operations that write */
+  int random;                 /* random blocks, or one after another */
+  double seconds;             /* how long to run for */
+};
+
+struct bench_thread {
+  pthread_t tid;
+  struct bench_opts *opts;
+  int index;
+  int fd;
+  unsigned long long base;    /* where our region of the device starts */
+  unsigned long long ops;
+  unsigned long long reads, writes;
+  unsigned long long bytes;
+  unsigned long long *lat;    /* ns for each operation */
+  size_t nlat, maxlat;
+  int err;                    /* errno of the first failure, if any */
+};
+
+static volatile int bench_stop;
+
+static unsigned long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* sizes may end in k, m or g */
+static unsigned long long parse_size(const char *s)
+{
+  char *end;
+  unsigned long long n = strtoull(s, &end, 0);
+
+  switch (*end) {
+  case 'g': case 'G':
+    n <<= 10;
+  case 'm': case 'M':
+    n <<= 10;
+  case 'k': case 'K':
+    n <<= 10;
+  }
+  return n;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-d dev[,dev...]] [-t threads] [-b block] [-s span]\n"
+          "          [-w write%%] [-r] [-T seconds]\n"
+          "  -d  devices to use (default /dev/my_scull0)\n"
+          "  -t  threads, spread over the devices (default 1)\n"
+          "  -b  bytes per operation, from 1 up (default 4k)\n"
+          "  -s  bytes of a device each thread works on (default 16m)\n"
+          "  -w  percentage of operations that are writes (default 0)\n"
+          "  -r  pick blocks at random instead of in order\n"
+          "  -T  how long to run, in seconds (default 5)\n", prog);
+  exit(2);
+}
+
+static void parse_devs(struct bench_opts *opts, char *list)
+{
+  char *dev;
+
+  opts->ndevs = 0;
+  for (dev = strtok(list, ","); dev; dev = strtok(NULL, ",")) {
+    opts->devs = realloc(opts->devs, (opts->ndevs + 1) * sizeof(char *));
+    opts->devs[opts->ndevs++] = dev;
+  }
+}
+
+static void add_latency(struct bench_thread *t, unsigned long long ns)
+{
+  if (t->nlat == t->maxlat) {
+    t->maxlat = t->maxlat ? t->maxlat * 2 : 65536;
+    t->lat = realloc(t->lat, t->maxlat * sizeof(*t->lat));
+    if (!t->lat) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  t->lat[t->nlat++] = ns;
+}
+
+/*
+ * The whole block, or the reason why not. *done is what got through,
+ * which is less than len for a read that runs into the end.
+ */
+static int do_io(int fd, char *buf, size_t len, off_t pos, int write,
+                 size_t *done)
+{
+  ssize_t n;
+
+  *done = 0;
+  while (len) {
+    n = write ? pwrite(fd, buf, len, pos) : pread(fd, buf, len, pos);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    if (n == 0)
+      return write ? ENOSPC : 0; /* a read past the end is just short */
+    buf += n;
+    len -= n;
+    pos += n;
+    *done += n;
+  }
+  return 0;
+}
+
+static void *bench_run(void *arg)
+{
+  struct bench_thread *t = arg;
+  struct bench_opts *opts = t->opts;
+  unsigned long long nblocks = opts->span / opts->block;
+  unsigned long long block = 0, start, ns;
+  unsigned int seed = t->index + 1;
+  size_t done;
+  char *buf;
+  int write;
+
+  buf = malloc(opts->block);
+  if (!buf) {
+    t->err = ENOMEM;
+    return NULL;
+  }
+  memset(buf, 'a' + t->index % 26, opts->block);
+
+  while (!bench_stop) {
+    if (opts->random)
+      block = ((unsigned long long) rand_r(&seed) << 31 | rand_r(&seed)) % nblocks;
+    write = rand_r(&seed) % 100 < opts->write_pct;
+
+    start = now_ns();
+    t->err = do_io(t->fd, buf, opts->block,
+                   t->base + block * opts->block, write, &done);
+    ns = now_ns() - start;
+    if (t->err)
+      break; /* a failure's time says nothing about the device */
+    add_latency(t, ns);
+
+    t->ops++;
+    t->bytes += done;
+    if (write)
+      t->writes++;
+    else
+      t->reads++;
+    if (!opts->random && ++block == nblocks)
+      block = 0;
+  }
+  free(buf);
+  return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static unsigned long long percentile(unsigned long long *v, size_t n,
+                                     double p)
+{
+  size_t i;
+
+  if (!n)
+    return 0;
+  i = (size_t) (p * n);
+  return v[i < n ? i : n - 1];
+}
+
+int main(int argc, char **argv)
+{
+  struct bench_opts opts = {
+    .threads = 1, .block = 4096, .span = 16 << 20, .seconds = 5,
+  };
+  struct bench_thread *threads, *t;
+  unsigned long long *lat, start, elapsed, ops = 0, reads = 0, writes = 0;
+  unsigned long long bytes = 0;
+  size_t nlat = 0;
+  char *buf;
+  double secs;
+  size_t done;
+  int c, i, err = 0;
+
+  while ((c = getopt(argc, argv, "d:t:b:s:w:rT:h")) != -1) {
+    switch (c) {
+    case 'd': parse_devs(&opts, optarg); break;
+    case 't': opts.threads = atoi(optarg); break;
+    case 'b': opts.block = parse_size(optarg); break;
+    case 's': opts.span = parse_size(optarg); break;
+    case 'w': opts.write_pct = atoi(optarg); break;
+    case 'r': opts.random = 1; break;
+    case 'T': opts.seconds = atof(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (!opts.ndevs) {
+    static char *def[] = { "/dev/my_scull0" };
+
+    opts.devs = def;
+    opts.ndevs = 1;
+  }
+  if (opts.threads < 1 || !opts.block || opts.span < opts.block ||
+      opts.write_pct < 0 || opts.write_pct > 100 || opts.seconds <= 0)
+    usage(argv[0]);
+
+  threads = calloc(opts.threads, sizeof(*threads));
+  if (!threads) {
+    perror("calloc");
+    return 1;
+  }
+
+  /*
+   * O_RDWR rather than O_WRONLY: a write-only open trims the device.
+   * Then put something in every region that is going to be read.
+   */
+  for (i = 0; i < opts.threads; i++) {
+    t = threads + i;
+    t->opts = &opts;
+    t->index = i;
+    t->base = (unsigned long long) (i / opts.ndevs) * opts.span;
+    t->fd = open(opts.devs[i % opts.ndevs], O_RDWR);
+    if (t->fd < 0) {
+      fprintf(stderr, "%s: %s\n", opts.devs[i % opts.ndevs], strerror(errno));
+      return 1;
+    }
+    if (opts.write_pct < 100) {
+      unsigned long long pos;
+      size_t chunk = 1 << 20;
+
+      buf = calloc(1, chunk);
+      for (pos = 0; buf && pos < opts.span; pos += chunk) {
+        if (chunk > opts.span - pos)
+          chunk = opts.span - pos;
+        err = do_io(t->fd, buf, chunk, t->base + pos, 1, &done);
+        if (err) {
+          fprintf(stderr, "filling %s: %s\n", opts.devs[i % opts.ndevs],
+                  strerror(err));
+          return 1;
+        }
+      }
+      free(buf);
+    }
+  }
+
+  start = now_ns();
+  for (i = 0; i < opts.threads; i++)
+    if (pthread_create(&threads[i].tid, NULL, bench_run, threads + i)) {
+      perror("pthread_create");
+      return 1;
+    }
+  while (!bench_stop) {
+    usleep(10000);
+    if (now_ns() - start >= opts.seconds * 1e9)
+      bench_stop = 1;
+  }
+  for (i = 0; i < opts.threads; i++)
+    pthread_join(threads[i].tid, NULL);
+  elapsed = now_ns() - start;
+
+  /* put everything together */
+  for (i = 0; i < opts.threads; i++) {
+    t = threads + i;
+    ops += t->ops;
+    reads += t->reads;
+    writes += t->writes;
+    bytes += t->bytes;
+    nlat += t->nlat;
+    if (t->err && !err)
+      err = t->err;
+    close(t->fd);
+  }
+  lat = malloc((nlat ? nlat : 1) * sizeof(*lat));
+  if (!lat) {
+    perror("malloc");
+    return 1;
+  }
+  for (nlat = 0, i = 0; i < opts.threads; i++) {
+    memcpy(lat + nlat, threads[i].lat, threads[i].nlat * sizeof(*lat));
+    nlat += threads[i].nlat;
+    free(threads[i].lat);
+  }
+  qsort(lat, nlat, sizeof(*lat), cmp_u64);
+
+  secs = elapsed / 1e9;
+  printf("{\"devices\": %d, \"threads\": %d, \"block\": %zu, \"span\": %llu, "
+         "\"write_pct\": %d, \"pattern\": \"%s\", \"seconds\": %.3f, "
+         "\"ops\": %llu, \"reads\": %llu, \"writes\": %llu, "
+         "\"mb_per_s\": %.2f, \"ops_per_s\": %.0f, "
+         "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+         "\"max_ns\": %llu, \"error\": \"%s\"}\n",
+         opts.ndevs, opts.threads, opts.block, opts.span, opts.write_pct,
+         opts.random ? "random" : "sequential", secs, ops, reads, writes,
+         bytes / secs / (1 << 20), ops / secs,
+         percentile(lat, nlat, 0.50), percentile(lat, nlat, 0.99),
+         percentile(lat, nlat, 0.999), nlat ? lat[nlat - 1] : 0ULL,
+         err ? strerror(err) : "");
+  free(lat);
+  free(threads);
+  return err ? 1 : 0;
+}
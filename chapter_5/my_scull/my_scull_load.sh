@@ -17,6 +17,12 @@ mknod /dev/${device}1 c $major 1
 mknod /dev/${device}2 c $major 2
 mknod /dev/${device}3 c $major 3
 
+rm -f /dev/${device}pipe[0-3]
+mknod /dev/${device}pipe0 c $major 4
+mknod /dev/${device}pipe1 c $major 5
+mknod /dev/${device}pipe2 c $major 6
+mknod /dev/${device}pipe3 c $major 7
+
 # give appropriate group/permissions, and change the group.
 # Not all distributions have staff, some have "wheel" instead.
 group="staff"
@@ -24,3 +30,5 @@ grep -q '^staff:' /etc/group || group="wheel"
 
 chgrp $group /dev/${device}[0-3]
 chmod $mode  /dev/${device}[0-3]
+chgrp $group /dev/${device}pipe[0-3]
+chmod $mode  /dev/${device}pipe[0-3]
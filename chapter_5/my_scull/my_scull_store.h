@@ -0,0 +1,181 @@
+/*
+ * my_scull_store.h -- the store, see store.c
+ *
+ * What main.c needs to work on a store. The small helpers every read
+ * and write goes through are inline, the rest is in store.c.
+ */
+
+#ifndef _MY_SCULL_STORE_H_
+#define _MY_SCULL_STORE_H_
+
+/*
+ * How many quantum sets to pull out of the index at a time
+ */
+#define MY_SCULL_GANG 16
+
+static inline u64 my_scull_now(void)
+{
+  return ktime_to_ns(ktime_get());
+}
+
+/*
+ * The size is 64 bits wide, which a 32-bit machine can't read in one
+ * go. There, lockless readers go through a seqcount, as for i_size.
+ */
+static inline loff_t my_scull_size(struct my_scull_store *store)
+{
+#if BITS_PER_LONG == 32
+  loff_t size;
+  unsigned int seq;
+
+  do {
+    seq = read_seqcount_begin(&store->size_seq);
+    size = store->size;
+  } while (read_seqcount_retry(&store->size_seq, seq));
+  return size;
+#else
+  return ACCESS_ONCE(store->size);
+#endif
+}
+
+/* the caller holds store->lock */
+static inline void my_scull_set_size(struct my_scull_store *store, loff_t size)
+{
+#if BITS_PER_LONG == 32
+  write_seqcount_begin(&store->size_seq);
+  store->size = size;
+  write_seqcount_end(&store->size_seq);
+#else
+  store->size = size;
+#endif
+}
+
+/*
+ * Are the quanta page allocations, which can be mapped and spliced?
+ * Otherwise they come from a slab cache, see store.c.
+ */
+static inline int my_scull_page_quanta(struct my_scull_store *store)
+{
+  return !(store->quantum % PAGE_SIZE);
+}
+
+/*
+ * Turn a device offset into the list item, the index into that quantum
+ * set, and the index into that quantum. Offsets are 64-bit everywhere,
+ * and a list item spans at most 4GB, so one div_u64_rem does it. When
+ * both quantum and qset are powers of two, as they usually are, shifts
+ * and masks do it without dividing at all.
+ */
+static inline void my_scull_decode(struct my_scull_store *store, loff_t pos,
+                                   unsigned long *item, int *s_pos,
+                                   int *q_pos)
+{
+  u32 rest;
+
+  if (likely(store->pow2)) {
+    *item = pos >> store->item_shift;
+    *s_pos = (pos >> store->quantum_shift) & (store->qset - 1);
+    *q_pos = pos & (store->quantum - 1);
+    return;
+  }
+  *item = div_u64_rem(pos, (u32) store->quantum * store->qset, &rest);
+  *s_pos = rest / store->quantum;
+  *q_pos = rest % store->quantum;
+}
+
+/* where list item "item" starts */
+static inline loff_t my_scull_item_start(struct my_scull_store *store,
+                                         unsigned long item)
+{
+  if (likely(store->pow2))
+    return (loff_t) item << store->item_shift;
+  return (loff_t) item * store->quantum * store->qset;
+}
+
+/*
+ * Look up list item n in the index. Never allocates: returns NULL if
+ * nothing has been written that far.
+ *
+ * Safe without dev->sem: the radix tree frees its nodes through RCU,
+ * and the quantum set we return lives as long as the caller's hold on
+ * the store.
+ */
+static inline struct my_scull_qset *
+my_scull_lookup(struct my_scull_store *store, unsigned long n)
+{
+  struct my_scull_qset *qs;
+
+  rcu_read_lock();
+  qs = radix_tree_lookup(&store->index, n);
+  rcu_read_unlock();
+  return qs;
+}
+
+/*
+ * A locked quantum set is about to change. While the store is being
+ * re-chunked, mark it so that the change is copied over again.
+ */
+static inline void my_scull_touch(struct my_scull_store *store,
+                                  struct my_scull_qset *dataptr)
+{
+  if (unlikely(ACCESS_ONCE(store->rechunking)))
+    dataptr->dirty = 1;
+}
+
+/*
+ * A cursor over the user's buffers. read and write move through the
+ * quanta once, and use this to fill (or drain) however many buffers
+ * they were given along the way.
+ */
+struct my_scull_iov {
+  const struct iovec *iov;    /* the current segment */
+  unsigned long nr_segs;      /* segments left, this one included */
+  size_t offset;              /* how far into the current segment */
+};
+
+int     my_scull_store_init(int qset);
+void    my_scull_store_exit(void);
+
+struct my_scull_store *my_scull_alloc_store(struct my_scull_dev *dev,
+                                            int quantum, int qset);
+void    my_scull_free_store(struct my_scull_store *store);
+void    my_scull_free_store_work(struct work_struct *work); /* in main.c */
+void    my_scull_free_qset(struct my_scull_store *store,
+                           struct my_scull_qset *dataptr);
+void    my_scull_free_quantum(struct my_scull_store *store, void *quantum);
+
+int     my_scull_geometry_ok(int quantum, int qset);
+int     my_scull_in_range(struct my_scull_store *store, loff_t end);
+u64     my_scull_footprint(struct my_scull_store *store);
+
+struct my_scull_qset *my_scull_next_qset(struct my_scull_store *store,
+                                         unsigned long first);
+struct my_scull_qset *my_scull_follow(struct my_scull_store *store,
+                                      unsigned long n);
+void   *my_scull_fill(struct my_scull_store *store,
+                      struct my_scull_qset *dataptr, int s_pos);
+void    my_scull_grow(struct my_scull_store *store, loff_t end);
+
+ssize_t my_scull_store_read(struct my_scull_store *store,
+                            struct my_scull_iov *it, loff_t pos, size_t count);
+ssize_t my_scull_store_write(struct my_scull_store *store,
+                             struct my_scull_iov *it, loff_t pos,
+                             size_t count, int nonblock);
+int     my_scull_store_punch(struct my_scull_store *store, loff_t offset,
+                             loff_t len);
+int     my_scull_store_truncate(struct my_scull_store *store, loff_t size);
+
+/*
+ * Freeing what lockless readers may still be looking at, for punch and
+ * truncate: in main.c, and my_scull_ushim.c frees on the spot
+ */
+struct my_scull_reap;
+
+struct my_scull_reap *my_scull_reap_alloc(struct my_scull_store *store,
+                                          gfp_t gfp);
+void    my_scull_reap_done(struct my_scull_reap *reap);
+void    my_scull_reap_quantum(struct my_scull_reap **reap, void *quantum);
+void    my_scull_reap_qset(struct my_scull_reap **reap,
+                           struct my_scull_qset *dataptr);
+
+#endif /* _MY_SCULL_STORE_H_ */
@@ -0,0 +1,185 @@
+/*
+ * my_scull_store_bench.c -- the storage engine on its own, in user space
+ *
+ * Builds store.c against my_scull_ushim.h and times its read and write
+ * paths, with no module to load and no system calls in the way, so it
+ * can be run under perf or cachegrind:
+ *
+ *   fill      write every quantum of "size" bytes, a quantum at a time
+ *   lookup    read a byte of every quantum again, in order
+ *   random    "block"-byte reads from random offsets
+ *   sparse    write a byte to each of "ops" quanta scattered over a
+ *             1000 times larger range
+ *   free      free the stores
+ *
+ * and prints one line of JSON, ns per operation for each.
+ */
+
+#include "my_scull_ushim.h"
+#include "my_scull.h"
+#include "my_scull_store.h"
+
+#include <time.h>
+#include <unistd.h>
+
+int my_scull_major, my_scull_nr_devs, my_scull_p_buffer; /* for my_scull.h */
+
+static unsigned long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 64 random bits */
+static unsigned long long next_rand(unsigned long long *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static unsigned long long parse_size(const char *s)
+{
+  char *end;
+  unsigned long long n = strtoull(s, &end, 0);
+
+  switch (*end) {
+  case 'g': case 'G':
+    n <<= 10;
+  case 'm': case 'M':
+    n <<= 10;
+  case 'k': case 'K':
+    n <<= 10;
+  }
+  return n;
+}
+
+/* a write and a read, through the same walk as my_scull_do_write/read */
+static ssize_t bench_write(struct my_scull_store *store, loff_t pos,
+                           char *buf, size_t count)
+{
+  struct iovec iov = { buf, count };
+  struct my_scull_iov it = { &iov, 1, 0 };
+
+  return my_scull_store_write(store, &it, pos, count, 0);
+}
+
+static ssize_t bench_read(struct my_scull_store *store, loff_t pos,
+                          char *buf, size_t count)
+{
+  struct iovec iov = { buf, count };
+  struct my_scull_iov it = { &iov, 1, 0 };
+
+  return my_scull_store_read(store, &it, pos, count);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-q quantum] [-s qset] [-n size] [-b block] [-o ops]\n"
+          "  -q  quantum size (default 4096)\n"
+          "  -s  quanta per quantum set (default 1000)\n"
+          "  -n  bytes to fill (default 256m)\n"
+          "  -b  bytes per random read (default 64)\n"
+          "  -o  random reads and sparse fills (default 1000000)\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  struct my_scull_dev dev;
+  struct my_scull_store *store, *sparse;
+  unsigned long long size = 256 << 20, ops = 1000000, block = 64;
+  unsigned long long rnd = 88172645463325252ULL, i, nquanta, t;
+  unsigned long long t_fill, t_lookup, t_random, t_sparse, t_free;
+  int quantum = 4096, qset = 1000, c;
+  char *buf;
+  loff_t pos;
+
+  while ((c = getopt(argc, argv, "q:s:n:b:o:h")) != -1) {
+    switch (c) {
+    case 'q': quantum = parse_size(optarg); break;
+    case 's': qset = atoi(optarg); break;
+    case 'n': size = parse_size(optarg); break;
+    case 'b': block = parse_size(optarg); break;
+    case 'o': ops = parse_size(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (!my_scull_geometry_ok(quantum, qset) || size < quantum || !block ||
+      block > size)
+    usage(argv[0]);
+
+  memset(&dev, 0, sizeof(dev));
+  dev.stats = calloc(1, sizeof(*dev.stats));
+  buf = calloc(1, block > quantum ? block : quantum);
+  if (!dev.stats || !buf || my_scull_store_init(qset)) {
+    perror("my_scull_store_bench");
+    return 1;
+  }
+  store = my_scull_alloc_store(&dev, quantum, qset);
+  sparse = my_scull_alloc_store(&dev, quantum, qset);
+  if (!store || !sparse) {
+    perror("my_scull_store_bench");
+    return 1;
+  }
+  nquanta = size / quantum;
+
+  t = now_ns();
+  for (i = 0; i < nquanta; i++)
+    if (bench_write(store, (loff_t) i * quantum, buf, quantum) != quantum) {
+      perror("fill");
+      return 1;
+    }
+  t_fill = now_ns() - t;
+
+  t = now_ns();
+  for (i = 0; i < nquanta; i++)
+    bench_read(store, (loff_t) i * quantum, buf, 1);
+  t_lookup = now_ns() - t;
+
+  t = now_ns();
+  for (i = 0; i < ops; i++) {
+    pos = next_rand(&rnd) % (nquanta * quantum - block + 1);
+    bench_read(store, pos, buf, block);
+  }
+  t_random = now_ns() - t;
+
+  t = now_ns();
+  for (i = 0; i < ops; i++) {
+    pos = (next_rand(&rnd) % (nquanta * 1000)) * quantum;
+    if (bench_write(sparse, pos, buf, 1) != 1) {
+      perror("sparse fill");
+      return 1;
+    }
+  }
+  t_sparse = now_ns() - t;
+
+  printf("{\"quantum\": %i, \"qset\": %i, \"size\": %llu, \"block\": %llu, "
+         "\"ops\": %llu, \"qsets\": %i, \"allocs\": %llu, "
+         "\"bytes_allocated\": %llu, ",
+         quantum, qset, size, block, ops,
+         atomic_read(&store->nr_qsets) + atomic_read(&sparse->nr_qsets),
+         (unsigned long long) dev.stats->allocs,
+         (unsigned long long) (my_scull_footprint(store) +
+                               my_scull_footprint(sparse)));
+
+  t = now_ns();
+  my_scull_free_store(store);
+  my_scull_free_store(sparse);
+  t_free = now_ns() - t;
+
+  printf("\"fill_ns\": %.1f, \"lookup_ns\": %.1f, \"random_ns\": %.1f, "
+         "\"sparse_ns\": %.1f, \"free_ns\": %.1f}\n",
+         (double) t_fill / nquanta, (double) t_lookup / nquanta,
+         (double) t_random / ops, (double) t_sparse / ops,
+         (double) t_free / (nquanta + ops));
+
+  my_scull_store_exit();
+  free(buf);
+  free(dev.stats);
+  return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * my_scull_store_fuzz.c -- random work on a store, checked against a
+ * flat copy
+ *
+ * Each round makes a store with a random geometry, powers of two or
+ * not, and puts its data somewhere at random in the device, up in the
+ * terabytes as often as not. Then it writes random bytes to random
+ * ranges, reads random ranges back, and now and then punches a hole or
+ * truncates, all through the same store.c functions main.c calls.
+ * Every change also goes to a flat shadow buffer, which every read must
+ * match, and the store's counts of quantum sets and quanta must match
+ * what is left. Positions are checked against plain division as they
+ * go, and the store is freed at the end of the round.
+ *
+ *   ./my_scull_store_fuzz [-s seed] [-r rounds] [-o ops per round]
+ *
+ * A failure says which seed and round it was. "make fuzz" builds it
+ * with AddressSanitizer, so anything leaked or overrun stops it too.
+ */
+
+#include "my_scull_ushim.h"
+#include "my_scull.h"
+#include "my_scull_store.h"
+
+#include <stdarg.h>
+#include <unistd.h>
+
+int my_scull_major, my_scull_nr_devs, my_scull_p_buffer; /* for my_scull.h */
+
+#define FUZZ_MAX_SPAN  (4 << 20)  /* bytes of shadow per round, at most */
+#define FUZZ_MAX_IO    (64 << 10) /* bytes per read or write, at most */
+
+static unsigned long long seed = 1;
+static unsigned long round_nr;
+
+static unsigned long long rnd_state;
+
+static unsigned long long rnd(void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+  return rnd_state;
+}
+
+/* uniform enough in [0, n) */
+static unsigned long long rnd_below(unsigned long long n)
+{
+  return n ? rnd() % n : 0;
+}
+
+static void fail(const char *fmt, ...)
+{
+  va_list ap;
+
+  fprintf(stderr, "my_scull_store_fuzz: seed %llu round %lu: ", seed, round_nr);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  exit(1);
+}
+
+/*
+ * One round's worth of state
+ */
+struct fuzz {
+  struct my_scull_dev dev;
+  struct my_scull_store *store;
+  int quantum, qset;
+  loff_t base;                /* where the shadow starts in the device */
+  size_t span;                /* and how much of it there is */
+  loff_t size;                /* what the store's size should be */
+  unsigned char *shadow;
+  unsigned char *filled;      /* a byte per quantum from base on, set if allocated */
+  loff_t first_quantum;       /* the quantum number base is in */
+  size_t nr_quanta;           /* how many filled covers */
+  unsigned char *present;     /* and a byte per list item, set if in the index */
+  unsigned long first_item;
+  size_t nr_items;
+};
+
+/* my_scull_decode, the slow way */
+static void check_decode(struct my_scull_store *store, loff_t pos)
+{
+  unsigned long item;
+  int s_pos, q_pos;
+  u64 itemsize = (u64) store->quantum * store->qset;
+
+  my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+  if (item != pos / itemsize ||
+      s_pos != (int) ((pos % itemsize) / store->quantum) ||
+      q_pos != (int) ((pos % itemsize) % store->quantum))
+    fail("decode(%lld) gave item %lu s_pos %i q_pos %i, quantum %i qset %i",
+         (long long) pos, item, s_pos, q_pos, store->quantum, store->qset);
+  if (my_scull_item_start(store, item) + (loff_t) s_pos * store->quantum +
+      q_pos != pos)
+    fail("item_start(%lu) doesn't lead back to %lld", item, (long long) pos);
+}
+
+static ssize_t fuzz_store_write(struct fuzz *f, loff_t pos,
+                                unsigned char *buf, size_t len)
+{
+  struct iovec iov = { buf, len };
+  struct my_scull_iov it = { &iov, 1, 0 };
+
+  return my_scull_store_write(f->store, &it, pos, len, 0);
+}
+
+static void fuzz_write(struct fuzz *f, size_t off, size_t len)
+{
+  unsigned char buf[FUZZ_MAX_IO];
+  loff_t pos = f->base + off, q;
+  loff_t itemsize = (loff_t) f->quantum * f->qset;
+  size_t i;
+  ssize_t n;
+
+  for (i = 0; i < len; i++)
+    buf[i] = rnd();
+  check_decode(f->store, pos);
+  n = fuzz_store_write(f, pos, buf, len);
+  if (n != (ssize_t) len)
+    fail("write of %zu at %lld gave %zd", len, (long long) pos, n);
+
+  memcpy(f->shadow + off, buf, len);
+  for (q = pos / f->quantum; len && q <= (pos + (loff_t) len - 1) / f->quantum; q++)
+    f->filled[q - f->first_quantum] = 1;
+  for (q = pos / itemsize; len && q <= (pos + (loff_t) len - 1) / itemsize; q++)
+    f->present[q - f->first_item] = 1;
+  if (f->size < pos + (loff_t) len)
+    f->size = pos + len;
+}
+
+/* lookups only, holes read as zeros */
+static void fuzz_read(struct fuzz *f, size_t off, size_t len)
+{
+  unsigned char buf[FUZZ_MAX_IO];
+  struct iovec iov = { buf, len };
+  struct my_scull_iov it = { &iov, 1, 0 };
+  loff_t pos = f->base + off, size = my_scull_size(f->store);
+  ssize_t n;
+  size_t i;
+
+  if (size != f->size)
+    fail("size is %lld, should be %lld", (long long) size, (long long) f->size);
+  check_decode(f->store, pos);
+  n = my_scull_store_read(f->store, &it, pos, len);
+  if (pos >= size)
+    len = 0;
+  else if (pos + (loff_t) len > size)
+    len = size - pos;
+  if (n != (ssize_t) len)
+    fail("read of %zu at %lld gave %zd", len, (long long) pos, n);
+
+  for (i = 0; i < len; i++)
+    if (buf[i] != f->shadow[off + i])
+      fail("byte %lld reads %#x, should be %#x (read of %zu at %lld)",
+           (long long) (pos + i), buf[i], f->shadow[off + i], len,
+           (long long) pos);
+}
+
+/*
+ * A hole: whole quanta in the range go, the ends are zeroed, the list
+ * items and the size stay.
+ */
+static void fuzz_punch(struct fuzz *f, size_t off, size_t len)
+{
+  loff_t pos = f->base + off, end = pos + len, q;
+  int err;
+
+  err = my_scull_store_punch(f->store, pos, len);
+  if (err)
+    fail("punch of %zu at %lld gave %i", len, (long long) pos, err);
+
+  if (end > f->size)
+    end = f->size;
+  if (pos >= end)
+    return;
+  memset(f->shadow + off, 0, end - pos);
+  for (q = (pos + f->quantum - 1) / f->quantum; (q + 1) * f->quantum <= end; q++)
+    f->filled[q - f->first_quantum] = 0;
+}
+
+/*
+ * Truncate to somewhere in the shadow. Shrinking frees every quantum
+ * past the new end, and every list item after the one it falls in.
+ */
+static void fuzz_truncate(struct fuzz *f, size_t off)
+{
+  loff_t size = f->base + off, itemsize = (loff_t) f->quantum * f->qset, q;
+  size_t i;
+  int err;
+
+  err = my_scull_store_truncate(f->store, size);
+  if (err)
+    fail("truncate to %lld gave %i", (long long) size, err);
+
+  if (size >= f->size) {
+    f->size = size;
+    return;
+  }
+  f->size = size;
+  memset(f->shadow + off, 0, f->span - off);
+  for (q = (size + f->quantum - 1) / f->quantum;
+       q - f->first_quantum < (loff_t) f->nr_quanta; q++)
+    f->filled[q - f->first_quantum] = 0;
+  for (i = size / itemsize + 1 - f->first_item; i < f->nr_items; i++)
+    f->present[i] = 0;
+}
+
+/* the counts, and a walk of the index, against what we wrote */
+static void fuzz_check_counts(struct fuzz *f)
+{
+  struct my_scull_qset *qs;
+  unsigned long item;
+  size_t i;
+  int nr_quanta = 0, nr_qsets = 0, walked = 0;
+
+  for (i = 0; i < f->nr_quanta; i++)
+    nr_quanta += f->filled[i];
+  for (i = 0; i < f->nr_items; i++) {
+    if (!f->present[i])
+      continue;
+    nr_qsets++;
+    item = f->first_item + i;
+    qs = my_scull_lookup(f->store, item);
+    if (!qs || qs->item != item)
+      fail("item %lu isn't in the index", item);
+  }
+  if (atomic_read(&f->store->nr_quanta) != nr_quanta)
+    fail("%i quanta, should be %i", atomic_read(&f->store->nr_quanta),
+         nr_quanta);
+  if (atomic_read(&f->store->nr_qsets) != nr_qsets)
+    fail("%i quantum sets, should be %i", atomic_read(&f->store->nr_qsets),
+         nr_qsets);
+
+  for (qs = my_scull_next_qset(f->store, 0); qs;
+       qs = my_scull_next_qset(f->store, qs->item + 1)) {
+    if (qs != my_scull_lookup(f->store, qs->item))
+      fail("next_qset found item %lu, lookup doesn't", qs->item);
+    walked++;
+    if (qs->item == ULONG_MAX)
+      break;
+  }
+  if (walked != nr_qsets)
+    fail("walked %i quantum sets, should be %i", walked, nr_qsets);
+}
+
+/* quanta and qsets of every sort: tiny, odd, powers of two, pages */
+static void fuzz_geometry(int *quantum, int *qset)
+{
+  do {
+    switch (rnd_below(4)) {
+    case 0: *quantum = 1 + rnd_below(64); break;
+    case 1: *quantum = 1 + rnd_below(10000); break;
+    case 2: *quantum = 1 << rnd_below(15); break;
+    default: *quantum = PAGE_SIZE * (1 + rnd_below(3)); break;
+    }
+    switch (rnd_below(3)) {
+    case 0: *qset = 1 + rnd_below(8); break;
+    case 1: *qset = 1 + rnd_below(2000); break;
+    default: *qset = 1 << rnd_below(11); break;
+    }
+  } while (!my_scull_geometry_ok(*quantum, *qset));
+}
+
+static void fuzz_round(unsigned long ops)
+{
+  struct fuzz f;
+  unsigned long op;
+  size_t off, len;
+
+  memset(&f, 0, sizeof(f));
+  f.dev.stats = calloc(1, sizeof(*f.dev.stats));
+  fuzz_geometry(&f.quantum, &f.qset);
+  f.span = 1 + rnd_below(FUZZ_MAX_SPAN);
+  switch (rnd_below(3)) {
+  case 0: f.base = 0; break;
+  case 1: f.base = rnd_below(1LL << 32); break;
+  default: f.base = rnd_below(1LL << 50); break; /* a TiB or a thousand */
+  }
+  f.store = my_scull_alloc_store(&f.dev, f.quantum, f.qset);
+  if (!f.dev.stats || !f.store)
+    fail("out of memory setting up");
+  if (!my_scull_in_range(f.store, f.base + f.span))
+    f.base = 0; /* too far for a 32-bit list item */
+  f.shadow = calloc(1, f.span);
+  f.first_quantum = f.base / f.quantum;
+  f.nr_quanta = (f.base + f.span - 1) / f.quantum - f.first_quantum + 1;
+  f.filled = calloc(1, f.nr_quanta);
+  f.first_item = f.base / ((loff_t) f.quantum * f.qset);
+  f.nr_items = (f.base + f.span - 1) / ((loff_t) f.quantum * f.qset) -
+    f.first_item + 1;
+  f.present = calloc(1, f.nr_items);
+  if (!f.shadow || !f.filled || !f.present)
+    fail("out of memory setting up");
+
+  for (op = 0; op < ops; op++) {
+    off = rnd_below(f.span);
+    len = rnd_below(rnd_below(4) ? 2 * f.quantum + 2 : FUZZ_MAX_IO);
+    if (len > f.span - off)
+      len = f.span - off;
+    if (len > FUZZ_MAX_IO)
+      len = FUZZ_MAX_IO;
+    switch (rnd_below(20)) {
+    case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
+      fuzz_write(&f, off, len);
+      break;
+    case 8: case 9:
+      fuzz_punch(&f, off, len);
+      break;
+    case 10:
+      fuzz_truncate(&f, off);
+      break;
+    case 11:
+      check_decode(f.store, rnd_below(1ULL << 62));
+      break;
+    default:
+      fuzz_read(&f, off, len);
+      break;
+    }
+  }
+  fuzz_check_counts(&f);
+  if (my_scull_footprint(f.store) <
+      (u64) atomic_read(&f.store->nr_quanta) * f.quantum)
+    fail("footprint %llu is less than the quanta it holds",
+         (unsigned long long) my_scull_footprint(f.store));
+
+  my_scull_free_store(f.store);
+  free(f.present);
+  free(f.filled);
+  free(f.shadow);
+  free(f.dev.stats);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-s seed] [-r rounds] [-o ops]\n"
+          "  -s  random seed (default 1)\n"
+          "  -r  rounds, each with a new store (default 200)\n"
+          "  -o  operations per round (default 2000)\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long rounds = 200, ops = 2000;
+  int c;
+
+  while ((c = getopt(argc, argv, "s:r:o:h")) != -1) {
+    switch (c) {
+    case 's': seed = strtoull(optarg, NULL, 0); break;
+    case 'r': rounds = strtoul(optarg, NULL, 0); break;
+    case 'o': ops = strtoul(optarg, NULL, 0); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (my_scull_store_init(MY_SCULL_QSET)) {
+    perror("my_scull_store_fuzz");
+    return 1;
+  }
+
+  rnd_state = seed ? seed : 1;
+  for (round_nr = 0; round_nr < rounds; round_nr++) {
+    fuzz_round(ops);
+  }
+
+  my_scull_store_exit();
+  printf("my_scull_store_fuzz: seed %llu, %lu rounds of %lu operations, ok\n",
+         seed, rounds, ops);
+  return 0;
+}
@@ -0,0 +1,832 @@
+/*
+ * my_scull_store_test.c -- checks on the storage engine, in user space
+ *
+ * The module itself can only be tried out by loading it, so what can be
+ * checked without a kernel is checked here, on store.c built against
+ * my_scull_ushim.h:
+ *
+ *   boundaries   writes and reads across quantum and list item
+ *                boundaries, for geometries of every sort
+ *   sparse       data terabytes apart, and nothing allocated between
+ *   concurrent   writers racing for the same quantum sets and quanta,
+ *                with a reader looking on
+ *   punch        holes inside a quantum, over whole ones and across
+ *                list items, and what is left allocated after
+ *   truncate     growing, shrinking into the middle of a quantum and
+ *                growing back over zeros, and down to nothing
+ *   performance  64 MiB written and read back in order, and a million
+ *                random 64-byte reads, each against a floor
+ *
+ * Everything goes through the same store.c functions as main.c.
+ * "make test" runs this and then the fuzz harness.
+ *
+ * The floors come from my_scull_store_test.baseline, which holds what
+ * a reference machine measured and how fast it could memcpy. Each run
+ * times memcpy too, scales the baseline by how this machine compares,
+ * and fails what falls below a fraction of that (-f), so that only a
+ * real slowdown trips it. -u writes this machine's numbers to the
+ * baseline instead, -b reads another one, -p leaves the performance
+ * checks out, and -w, -r and -R set floors outright.
+ */
+
+#include "my_scull_ushim.h"
+#include "my_scull.h"
+#include "my_scull_store.h"
+
+#include <time.h>
+#include <unistd.h>
+
+int my_scull_major, my_scull_nr_devs, my_scull_p_buffer; /* for my_scull.h */
+
+/* what the performance checks measure, in MB/s and reads/s */
+struct perf {
+  double memcpy_mbs;          /* the calibration */
+  double write_mbs;
+  double read_mbs;
+  double random_ops;
+};
+
+static const char *baseline_file = "my_scull_store_test.baseline";
+static struct perf baseline;
+static double slack = 0.35;   /* how much of the scaled baseline must be met */
+static int update_baseline;
+
+/* floors set on the command line, 0 if they come from the baseline */
+static double min_write_mbs, min_read_mbs, min_random_ops;
+
+static int failures;
+
+#define CHECK(cond, fmt, args...)                                       \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%i: " fmt "\n", __func__, __LINE__, ## args); \
+      failures++;                                                       \
+      return;                                                           \
+    }                                                                   \
+  } while (0)
+
+static unsigned long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct my_scull_dev *test_dev(void)
+{
+  struct my_scull_dev *dev = calloc(1, sizeof(*dev));
+
+  if (!dev || !(dev->stats = calloc(1, sizeof(*dev->stats)))) {
+    perror("my_scull_store_test");
+    exit(1);
+  }
+  init_rwsem(&dev->sem);
+  return dev;
+}
+
+static void test_dev_free(struct my_scull_dev *dev)
+{
+  free(dev->stats);
+  free(dev);
+}
+
+/* what the byte at pos is written as */
+static unsigned char pattern(loff_t pos, int salt)
+{
+  return (pos * 131 + (pos >> 17) + salt) % 251 + 1; /* never zero */
+}
+
+/*
+ * Write count bytes at pos, and read them back, through what
+ * my_scull_do_write and my_scull_do_read call. Writers hold dev->sem
+ * shared as they do there. Each returns how much got through.
+ */
+static size_t store_write(struct my_scull_store *store, loff_t pos,
+                          const unsigned char *buf, size_t count)
+{
+  struct iovec iov = { (void *) buf, count };
+  struct my_scull_iov it = { &iov, 1, 0 };
+  ssize_t n;
+
+  down_read(&store->dev->sem);
+  n = my_scull_store_write(store, &it, pos, count, 0);
+  up_read(&store->dev->sem);
+  return n > 0 ? n : 0;
+}
+
+static size_t store_read(struct my_scull_store *store, loff_t pos,
+                         unsigned char *buf, size_t count)
+{
+  struct iovec iov = { buf, count };
+  struct my_scull_iov it = { &iov, 1, 0 };
+  ssize_t n = my_scull_store_read(store, &it, pos, count);
+
+  return n > 0 ? n : 0;
+}
+
+/*
+ * Boundaries: around every quantum and list item boundary in the first
+ * few list items, write a few bytes straddling it, then read all of it
+ * back against a flat copy. Whatever wasn't written must read as zeros.
+ */
+static void test_boundaries_one(int quantum, int qset)
+{
+  struct my_scull_dev *dev = test_dev();
+  struct my_scull_store *store = my_scull_alloc_store(dev, quantum, qset);
+  loff_t itemsize = (loff_t) quantum * qset, span, b, pos;
+  unsigned char *flat, *buf;
+  size_t len;
+  int lens[] = { 1, 2, 3, 7 };
+  int i;
+
+  CHECK(store, "no store");
+  span = 3 * itemsize + quantum + 1;
+  if (span > (16 << 20))
+    span = 16 << 20;
+  flat = calloc(1, span);
+  buf = malloc(span);
+  CHECK(flat && buf, "out of memory");
+
+  for (b = quantum; b < span; b += quantum) {
+    if (quantum > 64 && b % itemsize && b / quantum % 5)
+      continue; /* a few quantum boundaries, and all list item ones */
+    for (i = 0; i < 4; i++) {
+      pos = b - lens[i] / 2 - (i & 1);
+      len = lens[i];
+      if (pos < 0 || pos + (loff_t) len > span)
+        continue;
+      for (len = 0; len < (size_t) lens[i]; len++)
+        buf[len] = flat[pos + len] = pattern(pos + len, i);
+      CHECK(store_write(store, pos, buf, len) == len,
+            "quantum %i qset %i: short write at %lld", quantum, qset,
+            (long long) pos);
+    }
+  }
+  /*
+   * and one long write, from an odd place in the second list item over
+   * most of what follows, leaving the first to the short writes
+   */
+  pos = itemsize + quantum / 2 + 1;
+  if (pos < span) {
+    len = span - pos - quantum / 3;
+    for (i = 0; i < (int) len; i++)
+      buf[i] = flat[pos + i] = pattern(pos + i, 9);
+    CHECK(store_write(store, pos, buf, len) == len,
+          "quantum %i qset %i: short long write", quantum, qset);
+  }
+
+  span = my_scull_size(store);
+  CHECK(store_read(store, 0, buf, span) == (size_t) span,
+        "quantum %i qset %i: short read", quantum, qset);
+  for (pos = 0; pos < span; pos++)
+    CHECK(buf[pos] == flat[pos],
+          "quantum %i qset %i: byte %lld is %#x, should be %#x",
+          quantum, qset, (long long) pos, buf[pos], flat[pos]);
+
+  /* reading from every offset in a quantum, a byte at a time */
+  for (pos = itemsize - quantum - 1; pos < itemsize + quantum + 1 &&
+         pos < span; pos++) {
+    if (pos < 0)
+      continue;
+    CHECK(store_read(store, pos, buf, 1) == 1 && buf[0] == flat[pos],
+          "quantum %i qset %i: byte %lld alone", quantum, qset,
+          (long long) pos);
+  }
+  CHECK(store_read(store, span, buf, 1) == 0,
+        "quantum %i qset %i: read past the end", quantum, qset);
+
+  my_scull_free_store(store);
+  test_dev_free(dev);
+  free(flat);
+  free(buf);
+}
+
+static void test_boundaries(void)
+{
+  static const int geometry[][2] = {
+    { 4096, 1000 },           /* the default */
+    { 4000, 1000 },           /* LDD3's */
+    { 4096, 1024 },
+    { 8192, 3 },
+    { 64, 16 },
+    { 100, 7 },
+    { 1, 1 },
+    { 3, 5 },
+    { 1, 4096 },
+    { 4097, 2 },
+  };
+  int i;
+
+  for (i = 0; i < (int) (sizeof(geometry) / sizeof(geometry[0])); i++)
+    test_boundaries_one(geometry[i][0], geometry[i][1]);
+}
+
+/*
+ * Sparse: a few bytes terabytes apart. Only the quantum sets written to
+ * exist, the rest reads back as zeros, and the size is the last end.
+ */
+static void test_sparse_one(int quantum, int qset)
+{
+  static const loff_t where[] = {
+    0, 1LL << 32, (1LL << 40) - 3, 3LL << 40, (5LL << 40) + 12345,
+  };
+  struct my_scull_dev *dev = test_dev();
+  struct my_scull_store *store = my_scull_alloc_store(dev, quantum, qset);
+  struct my_scull_qset *qs;
+  unsigned char buf[64], zeros[64];
+  loff_t pos;
+  int i, j, n, walked = 0;
+  size_t len = sizeof(buf);
+
+  CHECK(store, "no store");
+  memset(zeros, 0, sizeof(zeros));
+  if (BITS_PER_LONG == 32 && !my_scull_in_range(store, 6LL << 40)) {
+    /* list items are numbered in an unsigned long, which runs out */
+    CHECK(store_write(store, 6LL << 40, buf, 1) == 0,
+          "quantum %i qset %i: a 32-bit store took a write past its range",
+          quantum, qset);
+    goto out;
+  }
+
+  for (i = 0; i < 5; i++) {
+    for (j = 0; j < (int) len; j++)
+      buf[j] = pattern(where[i] + j, i);
+    CHECK(store_write(store, where[i], buf, len) == len,
+          "quantum %i qset %i: write at %lld", quantum, qset,
+          (long long) where[i]);
+  }
+  CHECK(my_scull_size(store) == where[4] + (loff_t) len,
+        "quantum %i qset %i: size %lld", quantum, qset,
+        (long long) my_scull_size(store));
+
+  for (i = 0; i < 5; i++) {
+    CHECK(store_read(store, where[i], buf, len) == len,
+          "quantum %i qset %i: read at %lld", quantum, qset,
+          (long long) where[i]);
+    for (j = 0; j < (int) len; j++)
+      CHECK(buf[j] == pattern(where[i] + j, i),
+            "quantum %i qset %i: byte %lld", quantum, qset,
+            (long long) where[i] + j);
+    /* and a hole a little way after it */
+    pos = where[i] + len + 1000000;
+    if (i < 4) {
+      CHECK(store_read(store, pos, buf, len) == len &&
+            !memcmp(buf, zeros, len),
+            "quantum %i qset %i: hole at %lld", quantum, qset,
+            (long long) pos);
+    }
+  }
+
+  /* only what the five writes touched is allocated */
+  n = atomic_read(&store->nr_quanta);
+  CHECK(n >= 5 && n <= 5 * ((int) len / quantum + 2),
+        "quantum %i qset %i: %i quanta", quantum, qset, n);
+  n = atomic_read(&store->nr_qsets);
+  CHECK(n >= 5 && n <= 5 * ((int) len / quantum / qset + 2),
+        "quantum %i qset %i: %i quantum sets", quantum, qset, n);
+  for (qs = my_scull_next_qset(store, 0); qs;
+       qs = my_scull_next_qset(store, qs->item + 1))
+    walked++;
+  CHECK(walked == n, "quantum %i qset %i: walked %i quantum sets of %i",
+        quantum, qset, walked, n);
+  CHECK(my_scull_footprint(store) < (u64) 64 << 20,
+        "quantum %i qset %i: %llu bytes allocated", quantum, qset,
+        (unsigned long long) my_scull_footprint(store));
+
+ out:
+  my_scull_free_store(store);
+  test_dev_free(dev);
+}
+
+static void test_sparse(void)
+{
+  test_sparse_one(4096, 1000);
+  test_sparse_one(4096, 1024);
+  test_sparse_one(100, 7);
+  test_sparse_one(1, 1);
+}
+
+/*
+ * Concurrent writers: each thread writes its own bytes, but they are
+ * interleaved 37 at a time, so the threads fight over every quantum set
+ * and most quanta. A reader runs alongside and may only ever see zeros
+ * or the right bytes. Afterwards every byte is right and no quantum was
+ * allocated twice.
+ */
+#define CONC_THREADS 8
+#define CONC_STRIDE  37
+#define CONC_SIZE    (4 << 20)
+
+struct conc {
+  struct my_scull_store *store;
+  int index;
+  volatile int *stop;
+  int bad;                    /* what the reader saw that it shouldn't */
+};
+
+static void *conc_writer(void *arg)
+{
+  struct conc *c = arg;
+  unsigned char buf[CONC_STRIDE];
+  loff_t pos;
+  size_t i, len;
+
+  for (pos = (loff_t) c->index * CONC_STRIDE; pos < CONC_SIZE;
+       pos += CONC_THREADS * CONC_STRIDE) {
+    len = CONC_SIZE - pos < CONC_STRIDE ? CONC_SIZE - pos : CONC_STRIDE;
+    for (i = 0; i < len; i++)
+      buf[i] = pattern(pos + i, 0);
+    if (store_write(c->store, pos, buf, len) != len)
+      c->bad++;
+  }
+  return NULL;
+}
+
+static void *conc_reader(void *arg)
+{
+  struct conc *c = arg;
+  unsigned char buf[4096];
+  unsigned long long state = 12345;
+  loff_t pos;
+  size_t n, i;
+
+  while (!*c->stop) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    pos = state % CONC_SIZE;
+    n = store_read(c->store, pos, buf, sizeof(buf));
+    for (i = 0; i < n; i++)
+      if (buf[i] && buf[i] != pattern(pos + i, 0))
+        c->bad++;
+  }
+  return NULL;
+}
+
+static void test_concurrent_one(int quantum, int qset)
+{
+  struct my_scull_dev *dev = test_dev();
+  struct my_scull_store *store = my_scull_alloc_store(dev, quantum, qset);
+  struct conc c[CONC_THREADS + 1];
+  pthread_t tid[CONC_THREADS + 1];
+  volatile int stop = 0;
+  unsigned char *buf;
+  loff_t pos;
+  int i, bad = 0, quanta;
+
+  buf = malloc(CONC_SIZE);
+  CHECK(store && buf, "out of memory");
+  for (i = 0; i <= CONC_THREADS; i++) {
+    c[i].store = store;
+    c[i].index = i;
+    c[i].stop = &stop;
+    c[i].bad = 0;
+    if (pthread_create(&tid[i], NULL,
+                       i < CONC_THREADS ? conc_writer : conc_reader, &c[i])) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  for (i = 0; i < CONC_THREADS; i++)
+    pthread_join(tid[i], NULL);
+  stop = 1;
+  pthread_join(tid[CONC_THREADS], NULL);
+  for (i = 0; i <= CONC_THREADS; i++)
+    bad += c[i].bad;
+  CHECK(!bad, "quantum %i qset %i: %i bad writes or reads", quantum, qset, bad);
+
+  CHECK(my_scull_size(store) == CONC_SIZE, "quantum %i qset %i: size %lld",
+        quantum, qset, (long long) my_scull_size(store));
+  CHECK(store_read(store, 0, buf, CONC_SIZE) == CONC_SIZE,
+        "quantum %i qset %i: short read", quantum, qset);
+  for (pos = 0; pos < CONC_SIZE; pos++)
+    CHECK(buf[pos] == pattern(pos, 0), "quantum %i qset %i: byte %lld",
+          quantum, qset, (long long) pos);
+  quanta = (CONC_SIZE + quantum - 1) / quantum;
+  CHECK(atomic_read(&store->nr_quanta) == quanta,
+        "quantum %i qset %i: %i quanta, should be %i", quantum, qset,
+        atomic_read(&store->nr_quanta), quanta);
+  CHECK(atomic_read(&store->nr_qsets) == (quanta + qset - 1) / qset,
+        "quantum %i qset %i: %i quantum sets", quantum, qset,
+        atomic_read(&store->nr_qsets));
+
+  my_scull_free_store(store);
+  test_dev_free(dev);
+  free(buf);
+}
+
+static void test_concurrent(void)
+{
+  test_concurrent_one(4096, 1000);
+  test_concurrent_one(64, 16);
+  test_concurrent_one(100, 7);
+}
+
+/*
+ * A store with pattern(pos, 0) written over [0, span), and a flat copy
+ */
+static struct my_scull_store *filled_store(int quantum, int qset, loff_t span,
+                                           unsigned char **flat)
+{
+  struct my_scull_store *store = my_scull_alloc_store(test_dev(), quantum,
+                                                      qset);
+  loff_t pos;
+
+  *flat = malloc(span);
+  if (!store || !*flat) {
+    perror("my_scull_store_test");
+    exit(1);
+  }
+  for (pos = 0; pos < span; pos++)
+    (*flat)[pos] = pattern(pos, 0);
+  if (store_write(store, 0, *flat, span) != (size_t) span) {
+    perror("my_scull_store_test: filling a store");
+    exit(1);
+  }
+  return store;
+}
+
+static void free_filled_store(struct my_scull_store *store, unsigned char *flat)
+{
+  struct my_scull_dev *dev = store->dev;
+
+  my_scull_free_store(store);
+  test_dev_free(dev);
+  free(flat);
+}
+
+/* all of [0, span) against the flat copy */
+static int matches(struct my_scull_store *store, const unsigned char *flat,
+                   loff_t span)
+{
+  unsigned char *buf = malloc(span);
+  int ok;
+
+  ok = buf && store_read(store, 0, buf, span) == (size_t) span &&
+    !memcmp(buf, flat, span);
+  free(buf);
+  return ok;
+}
+
+/*
+ * Punch: each hole reads back as zeros and the rest as it was. Only
+ * quanta the hole covers whole are freed, and the size stays.
+ */
+static void test_punch_one(int quantum, int qset)
+{
+  loff_t itemsize = (loff_t) quantum * qset;
+  loff_t span = 3 * itemsize + quantum / 2 + 1, end;
+  struct my_scull_store *store;
+  unsigned char *flat;
+  struct {
+    loff_t off, len;
+    int freed;                /* quanta that go, -1 to leave uncounted */
+  } holes[] = {
+    { quantum / 2, 1, 0 },                          /* inside one */
+    { quantum, quantum, 1 },                        /* exactly one */
+    { itemsize - quantum / 2 - 1, 2 * quantum + 1, -1 }, /* across items */
+    { quantum, quantum, 0 },                        /* the same again */
+    { span - 3, 100, 0 },                           /* over the end */
+  };
+  int i, quanta;
+
+  if (span > (16 << 20))
+    span = 16 << 20;
+  store = filled_store(quantum, qset, span, &flat);
+
+  for (i = 0; i < (int) (sizeof(holes) / sizeof(holes[0])); i++) {
+    if (holes[i].off >= span)
+      continue;
+    quanta = atomic_read(&store->nr_quanta);
+    CHECK(my_scull_store_punch(store, holes[i].off, holes[i].len) == 0,
+          "quantum %i qset %i: hole %i failed", quantum, qset, i);
+    end = holes[i].off + holes[i].len < span ? holes[i].off + holes[i].len : span;
+    memset(flat + holes[i].off, 0, end - holes[i].off);
+    CHECK(my_scull_size(store) == span,
+          "quantum %i qset %i: hole %i changed the size to %lld", quantum,
+          qset, i, (long long) my_scull_size(store));
+    CHECK(holes[i].freed < 0 ||
+          atomic_read(&store->nr_quanta) == quanta - holes[i].freed,
+          "quantum %i qset %i: hole %i left %i quanta of %i", quantum, qset,
+          i, atomic_read(&store->nr_quanta), quanta);
+    CHECK(matches(store, flat, span),
+          "quantum %i qset %i: wrong data after hole %i", quantum, qset, i);
+  }
+
+  /* a freed quantum fills again, zeros around what is written */
+  flat[quantum + quantum / 2] = 'x';
+  CHECK(store_write(store, quantum + quantum / 2, flat + quantum + quantum / 2,
+                    1) == 1 && matches(store, flat, span),
+        "quantum %i qset %i: writing into a hole", quantum, qset);
+
+  free_filled_store(store, flat);
+}
+
+static void test_punch(void)
+{
+  test_punch_one(4096, 1000);
+  test_punch_one(4000, 1000);
+  test_punch_one(100, 7);
+  test_punch_one(8192, 3);
+  test_punch_one(3, 5);
+}
+
+/*
+ * Truncate: growing only moves the size. Shrinking frees every quantum
+ * and list item past the new end, and what comes back on growing again
+ * is zeros, even in the quantum the end fell in.
+ */
+static void test_truncate_one(int quantum, int qset)
+{
+  loff_t itemsize = (loff_t) quantum * qset;
+  loff_t span = 3 * itemsize + quantum / 2 + 1, cut;
+  struct my_scull_store *store;
+  unsigned char *flat, *buf;
+  int quanta, qsets;
+
+  if (span > (16 << 20))
+    span = 16 << 20;
+  cut = itemsize + quantum + quantum / 2; /* into the second list item */
+  if (cut >= span)
+    cut = span / 2;
+  store = filled_store(quantum, qset, span, &flat);
+  buf = calloc(1, span);
+  CHECK(buf, "out of memory");
+  quanta = atomic_read(&store->nr_quanta);
+  qsets = atomic_read(&store->nr_qsets);
+
+  CHECK(my_scull_store_truncate(store, span + 10 * itemsize) == 0 &&
+        my_scull_size(store) == span + 10 * itemsize &&
+        atomic_read(&store->nr_quanta) == quanta &&
+        atomic_read(&store->nr_qsets) == qsets,
+        "quantum %i qset %i: growing", quantum, qset);
+  CHECK(store_read(store, span + 5 * itemsize, buf, quantum) ==
+        (size_t) quantum && !buf[0] && !memcmp(buf, buf + 1, quantum - 1),
+        "quantum %i qset %i: growing didn't leave a hole", quantum, qset);
+
+  CHECK(my_scull_store_truncate(store, cut) == 0 &&
+        my_scull_size(store) == cut,
+        "quantum %i qset %i: shrinking to %lld", quantum, qset,
+        (long long) cut);
+  CHECK(atomic_read(&store->nr_quanta) == (cut + quantum - 1) / quantum,
+        "quantum %i qset %i: %i quanta left", quantum, qset,
+        atomic_read(&store->nr_quanta));
+  CHECK(atomic_read(&store->nr_qsets) == cut / itemsize + 1,
+        "quantum %i qset %i: %i quantum sets left", quantum, qset,
+        atomic_read(&store->nr_qsets));
+  CHECK(matches(store, flat, cut) && store_read(store, cut, buf, 1) == 0,
+        "quantum %i qset %i: wrong data after shrinking", quantum, qset);
+
+  /* back to the old size, over zeros */
+  memset(flat + cut, 0, span - cut);
+  CHECK(my_scull_store_truncate(store, span) == 0 && matches(store, flat, span),
+        "quantum %i qset %i: growing back", quantum, qset);
+
+  CHECK(my_scull_store_truncate(store, 0) == 0 && my_scull_size(store) == 0 &&
+        atomic_read(&store->nr_quanta) == 0 &&
+        atomic_read(&store->nr_qsets) == 1, /* the first keeps its head */
+        "quantum %i qset %i: truncating to nothing", quantum, qset);
+  CHECK(store_write(store, 0, flat, span) == (size_t) span &&
+        matches(store, flat, span),
+        "quantum %i qset %i: writing after truncating", quantum, qset);
+
+  if (!my_scull_in_range(store, LLONG_MAX))
+    CHECK(my_scull_store_truncate(store, LLONG_MAX) == -EFBIG,
+          "quantum %i qset %i: truncating out of range", quantum, qset);
+
+  free_filled_store(store, flat);
+  free(buf);
+}
+
+static void test_truncate(void)
+{
+  test_truncate_one(4096, 1000);
+  test_truncate_one(4000, 1000);
+  test_truncate_one(100, 7);
+  test_truncate_one(8192, 3);
+  test_truncate_one(1, 1);
+}
+
+/*
+ * Performance, against the floors
+ */
+#define PERF_SIZE   (64 << 20)
+#define PERF_BLOCK  4096
+#define PERF_RANDOM 1000000
+
+/*
+ * The calibration: the same 64 MiB as the sequential read, memcpy'd out
+ * a block at a time. Best of three, as it is the machine being measured
+ * and not the store.
+ */
+static double calibrate(void)
+{
+  unsigned char *src = malloc(PERF_SIZE), buf[PERF_BLOCK];
+  unsigned long long t;
+  double mbs, best = 0;
+  loff_t pos;
+  int i;
+
+  if (!src) {
+    perror("my_scull_store_test");
+    exit(1);
+  }
+  memset(src, 'x', PERF_SIZE);
+  for (i = 0; i < 3; i++) {
+    t = now_ns();
+    for (pos = 0; pos < PERF_SIZE; pos += PERF_BLOCK) {
+      memcpy(buf, src + pos, PERF_BLOCK);
+      __asm__ __volatile__("" : : "r" (buf) : "memory"); /* keep the copy */
+    }
+    mbs = PERF_SIZE / ((now_ns() - t) / 1e9) / (1 << 20);
+    if (mbs > best)
+      best = mbs;
+  }
+  free(src);
+  return best;
+}
+
+/*
+ * "name value" lines, and # comments. Returns 0 if all four were there.
+ */
+static int read_baseline(const char *path, struct perf *p)
+{
+  char line[256], name[64];
+  double value;
+  int found = 0;
+  FILE *f = fopen(path, "r");
+
+  if (!f)
+    return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || sscanf(line, "%63s %lf", name, &value) != 2)
+      continue;
+    if (!strcmp(name, "memcpy_mbs"))
+      p->memcpy_mbs = value, found |= 1;
+    else if (!strcmp(name, "write_mbs"))
+      p->write_mbs = value, found |= 2;
+    else if (!strcmp(name, "read_mbs"))
+      p->read_mbs = value, found |= 4;
+    else if (!strcmp(name, "random_ops"))
+      p->random_ops = value, found |= 8;
+  }
+  fclose(f);
+  return found == 15 && p->memcpy_mbs > 0 ? 0 : -1;
+}
+
+static int write_baseline(const char *path, const struct perf *p)
+{
+  FILE *f = fopen(path, "w");
+
+  if (!f)
+    return -1;
+  fprintf(f,
+          "# my_scull_store_test.baseline -- what the performance checks\n"
+          "# expect, written by \"./my_scull_store_test -u\"\n"
+          "#\n"
+          "# Measured on one machine, memcpy_mbs included. Other machines\n"
+          "# scale the rest by how fast they memcpy, see\n"
+          "# my_scull_store_test.c.\n"
+          "memcpy_mbs %.0f\n"
+          "write_mbs  %.0f\n"
+          "read_mbs   %.0f\n"
+          "random_ops %.0f\n",
+          p->memcpy_mbs, p->write_mbs, p->read_mbs, p->random_ops);
+  return fclose(f);
+}
+
+/* a floor from the command line, or the baseline scaled to this machine */
+static double floor_of(double given, double base, double scale)
+{
+  return given ? given : base * scale * slack;
+}
+
+static void test_performance(void)
+{
+  struct my_scull_dev *dev = test_dev();
+  struct my_scull_store *store = my_scull_alloc_store(dev, MY_SCULL_QUANTUM,
+                                                      MY_SCULL_QSET);
+  unsigned char buf[PERF_BLOCK];
+  unsigned long long t, state = 88172645463325252ULL;
+  struct perf now;
+  double scale, write_floor, read_floor, random_floor;
+  loff_t pos;
+  int i;
+
+  CHECK(store, "no store");
+  memset(buf, 'x', sizeof(buf));
+  now.memcpy_mbs = calibrate();
+
+  t = now_ns();
+  for (pos = 0; pos < PERF_SIZE; pos += PERF_BLOCK)
+    CHECK(store_write(store, pos, buf, PERF_BLOCK) == PERF_BLOCK, "write");
+  now.write_mbs = PERF_SIZE / ((now_ns() - t) / 1e9) / (1 << 20);
+
+  t = now_ns();
+  for (pos = 0; pos < PERF_SIZE; pos += PERF_BLOCK)
+    CHECK(store_read(store, pos, buf, PERF_BLOCK) == PERF_BLOCK, "read");
+  now.read_mbs = PERF_SIZE / ((now_ns() - t) / 1e9) / (1 << 20);
+
+  t = now_ns();
+  for (i = 0; i < PERF_RANDOM; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    store_read(store, state % (PERF_SIZE - 64), buf, 64);
+  }
+  now.random_ops = PERF_RANDOM / ((now_ns() - t) / 1e9);
+
+  my_scull_free_store(store);
+  test_dev_free(dev);
+
+  if (update_baseline) {
+    printf("  memcpy %.0f MB/s, 64 MiB sequential write %.0f MB/s, "
+           "read %.0f MB/s\n"
+           "  random 64-byte reads %.0f/s\n",
+           now.memcpy_mbs, now.write_mbs, now.read_mbs, now.random_ops);
+    CHECK(write_baseline(baseline_file, &now) == 0, "writing %s: %s",
+          baseline_file, strerror(errno));
+    printf("  written to %s\n", baseline_file);
+    return;
+  }
+
+  scale = now.memcpy_mbs / baseline.memcpy_mbs;
+  write_floor = floor_of(min_write_mbs, baseline.write_mbs, scale);
+  read_floor = floor_of(min_read_mbs, baseline.read_mbs, scale);
+  random_floor = floor_of(min_random_ops, baseline.random_ops, scale);
+  printf("  memcpy %.0f MB/s, %.2f times the baseline's\n"
+         "  64 MiB sequential write %.0f MB/s (floor %.0f), "
+         "read %.0f MB/s (floor %.0f)\n"
+         "  random 64-byte reads %.0f/s (floor %.0f)\n",
+         now.memcpy_mbs, scale, now.write_mbs, write_floor,
+         now.read_mbs, read_floor, now.random_ops, random_floor);
+  CHECK(now.write_mbs >= write_floor, "sequential write below its floor");
+  CHECK(now.read_mbs >= read_floor, "sequential read below its floor");
+  CHECK(now.random_ops >= random_floor, "random reads below their floor");
+}
+
+static void run(const char *name, void (*test)(void))
+{
+  int before = failures;
+
+  printf("%s\n", name);
+  test();
+  printf("%s: %s\n", name, failures == before ? "ok" : "FAILED");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-p] [-u] [-b baseline] [-f fraction] [-w MB/s] "
+          "[-r MB/s] [-R reads/s]\n"
+          "  -p  leave out the performance checks\n"
+          "  -u  write this machine's numbers to the baseline, check nothing\n"
+          "  -b  baseline file (default %s)\n"
+          "  -f  fraction of the scaled baseline to meet (default %.2f)\n"
+          "  -w  floor for sequential writes, instead of the baseline's\n"
+          "  -r  floor for sequential reads\n"
+          "  -R  floor for random 64-byte reads\n", prog, baseline_file,
+          slack);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  int perf = 1, c;
+
+  while ((c = getopt(argc, argv, "pub:f:w:r:R:h")) != -1) {
+    switch (c) {
+    case 'p': perf = 0; break;
+    case 'u': update_baseline = 1; break;
+    case 'b': baseline_file = optarg; break;
+    case 'f': slack = atof(optarg); break;
+    case 'w': min_write_mbs = atof(optarg); break;
+    case 'r': min_read_mbs = atof(optarg); break;
+    case 'R': min_random_ops = atof(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (perf && !update_baseline && read_baseline(baseline_file, &baseline)) {
+    fprintf(stderr, "my_scull_store_test: no usable baseline in %s "
+            "(-u makes one, -p goes without)\n", baseline_file);
+    return 2;
+  }
+  if (my_scull_store_init(MY_SCULL_QSET)) {
+    perror("my_scull_store_test");
+    return 1;
+  }
+
+  run("boundaries", test_boundaries);
+  run("sparse", test_sparse);
+  run("concurrent", test_concurrent);
+  run("punch", test_punch);
+  run("truncate", test_truncate);
+  if (perf)
+    run("performance", test_performance);
+
+  my_scull_store_exit();
+  if (failures)
+    printf("%i failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * my_scull_trace.h -- tracepoints for the my_scull devices
+ *
+ * Turn them on through /sys/kernel/debug/tracing/events/my_scull/.
+ * Every event carries the minor number of the device it is about.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM my_scull
+
+#if !defined(_MY_SCULL_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _MY_SCULL_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/*
+ * The locks that lock_acquire and lock_release talk about
+ */
+#define MY_SCULL_LOCK_SEM  0 /* my_scull_dev->sem */
+#define MY_SCULL_LOCK_QSET 1 /* my_scull_qset->lock */
+
+#define show_my_scull_lock(lock)                  \
+  __print_symbolic(lock,                          \
+                   { MY_SCULL_LOCK_SEM,  "sem" }, \
+                   { MY_SCULL_LOCK_QSET, "qset" })
+
+/*
+ * read and write
+ */
+DECLARE_EVENT_CLASS(my_scull_io_enter,
+
+  TP_PROTO(int minor, loff_t pos, size_t count),
+
+  TP_ARGS(minor, pos, count),
+
+  TP_STRUCT__entry(
+    __field(int,    minor)
+    __field(loff_t, pos)
+    __field(size_t, count)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->pos   = pos;
+    __entry->count = count;
+  ),
+
+  TP_printk("dev %d pos %lld count %zu",
+            __entry->minor, (long long) __entry->pos, __entry->count)
+);
+
+DEFINE_EVENT(my_scull_io_enter, my_scull_read_enter,
+  TP_PROTO(int minor, loff_t pos, size_t count),
+  TP_ARGS(minor, pos, count)
+);
+
+DEFINE_EVENT(my_scull_io_enter, my_scull_write_enter,
+  TP_PROTO(int minor, loff_t pos, size_t count),
+  TP_ARGS(minor, pos, count)
+);
+
+DECLARE_EVENT_CLASS(my_scull_io_exit,
+
+  TP_PROTO(int minor, ssize_t ret, u64 ns),
+
+  TP_ARGS(minor, ret, ns),
+
+  TP_STRUCT__entry(
+    __field(int,     minor)
+    __field(ssize_t, ret)
+    __field(u64,     ns)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->ret   = ret;
+    __entry->ns    = ns;
+  ),
+
+  TP_printk("dev %d ret %zd took %llu ns",
+            __entry->minor, __entry->ret, (unsigned long long) __entry->ns)
+);
+
+DEFINE_EVENT(my_scull_io_exit, my_scull_read_exit,
+  TP_PROTO(int minor, ssize_t ret, u64 ns),
+  TP_ARGS(minor, ret, ns)
+);
+
+DEFINE_EVENT(my_scull_io_exit, my_scull_write_exit,
+  TP_PROTO(int minor, ssize_t ret, u64 ns),
+  TP_ARGS(minor, ret, ns)
+);
+
+/*
+ * Looking up (and maybe adding) a quantum set
+ */
+TRACE_EVENT(my_scull_follow_enter,
+
+  TP_PROTO(int minor, unsigned long item),
+
+  TP_ARGS(minor, item),
+
+  TP_STRUCT__entry(
+    __field(int,           minor)
+    __field(unsigned long, item)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->item  = item;
+  ),
+
+  TP_printk("dev %d item %lu", __entry->minor, __entry->item)
+);
+
+TRACE_EVENT(my_scull_follow_exit,
+
+  TP_PROTO(int minor, unsigned long item, const void *qset),
+
+  TP_ARGS(minor, item, qset),
+
+  TP_STRUCT__entry(
+    __field(int,           minor)
+    __field(unsigned long, item)
+    __field(const void *,  qset)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->item  = item;
+    __entry->qset  = qset;
+  ),
+
+  TP_printk("dev %d item %lu qset %p",
+            __entry->minor, __entry->item, __entry->qset)
+);
+
+/*
+ * Trimming
+ */
+TRACE_EVENT(my_scull_trim_enter,
+
+  TP_PROTO(int minor, loff_t size),
+
+  TP_ARGS(minor, size),
+
+  TP_STRUCT__entry(
+    __field(int,    minor)
+    __field(loff_t, size)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->size  = size;
+  ),
+
+  TP_printk("dev %d size %lld", __entry->minor, (long long) __entry->size)
+);
+
+TRACE_EVENT(my_scull_trim_exit,
+
+  TP_PROTO(int minor, int ret),
+
+  TP_ARGS(minor, ret),
+
+  TP_STRUCT__entry(
+    __field(int, minor)
+    __field(int, ret)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->ret   = ret;
+  ),
+
+  TP_printk("dev %d ret %d", __entry->minor, __entry->ret)
+);
+
+/*
+ * Locks, with how long it took to get them
+ */
+TRACE_EVENT(my_scull_lock_acquire,
+
+  TP_PROTO(int minor, int lock, u64 wait_ns),
+
+  TP_ARGS(minor, lock, wait_ns),
+
+  TP_STRUCT__entry(
+    __field(int, minor)
+    __field(int, lock)
+    __field(u64, wait_ns)
+  ),
+
+  TP_fast_assign(
+    __entry->minor   = minor;
+    __entry->lock    = lock;
+    __entry->wait_ns = wait_ns;
+  ),
+
+  TP_printk("dev %d %s waited %llu ns", __entry->minor,
+            show_my_scull_lock(__entry->lock),
+            (unsigned long long) __entry->wait_ns)
+);
+
+TRACE_EVENT(my_scull_lock_release,
+
+  TP_PROTO(int minor, int lock),
+
+  TP_ARGS(minor, lock),
+
+  TP_STRUCT__entry(
+    __field(int, minor)
+    __field(int, lock)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->lock  = lock;
+  ),
+
+  TP_printk("dev %d %s", __entry->minor, show_my_scull_lock(__entry->lock))
+);
+
+#endif /* _MY_SCULL_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE my_scull_trace
+#include <trace/define_trace.h>
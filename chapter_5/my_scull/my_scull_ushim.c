@@ -0,0 +1,230 @@
+/*
+ * my_scull_ushim.c -- a radix tree, and somewhere for punch and
+ * truncate to put what they free, for store.c in user space
+ *
+ * Shaped like the kernel's: 64 slots a node, and the tree only grows
+ * as tall as the largest index needs. Each node knows its own height,
+ * so a lookup never has to read the height and the root separately.
+ * Inserts and deletes are serialized by the caller; lookups may run
+ * alongside inserts, but not alongside deletes, as nothing waits for
+ * readers before a node is freed.
+ */
+
+#include "my_scull_ushim.h"
+#include "my_scull.h"
+#include "my_scull_store.h"
+
+#define RADIX_TREE_MAP_SHIFT 6
+#define RADIX_TREE_MAP_SIZE  (1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK  (RADIX_TREE_MAP_SIZE - 1)
+
+struct radix_tree_node {
+  unsigned int height;        /* 1 for the nodes that hold items */
+  unsigned int count;         /* slots in use */
+  void *slots[RADIX_TREE_MAP_SIZE];
+};
+
+/* the largest index a tree of this height can hold */
+static unsigned long radix_tree_maxindex(unsigned int height)
+{
+  unsigned int shift = height * RADIX_TREE_MAP_SHIFT;
+
+  return shift >= BITS_PER_LONG ? ULONG_MAX : (1UL << shift) - 1;
+}
+
+static int radix_tree_slot(unsigned long index, unsigned int height)
+{
+  return (index >> ((height - 1) * RADIX_TREE_MAP_SHIFT)) & RADIX_TREE_MAP_MASK;
+}
+
+static struct radix_tree_node *radix_tree_node_alloc(unsigned int height)
+{
+  struct radix_tree_node *node = calloc(1, sizeof(*node));
+
+  if (node)
+    node->height = height;
+  return node;
+}
+
+#define radix_tree_load(p)       __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define radix_tree_publish(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+int radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+                      void *item)
+{
+  struct radix_tree_node *node = root->rnode, *child;
+  unsigned int height = 1;
+  int slot;
+
+  /* an empty tree starts out as tall as it needs to be */
+  if (!node) {
+    while (index > radix_tree_maxindex(height))
+      height++;
+    node = radix_tree_node_alloc(height);
+    if (!node)
+      return -ENOMEM;
+    radix_tree_publish(root->rnode, node);
+  }
+
+  /* otherwise grow it, putting the old root under a new one */
+  while (index > radix_tree_maxindex(node->height)) {
+    child = node;
+    node = radix_tree_node_alloc(child->height + 1);
+    if (!node)
+      return -ENOMEM;
+    node->slots[0] = child;
+    node->count = 1;
+    radix_tree_publish(root->rnode, node);
+  }
+
+  /* then walk down, adding nodes on the way */
+  while (node->height > 1) {
+    slot = radix_tree_slot(index, node->height);
+    child = node->slots[slot];
+    if (!child) {
+      child = radix_tree_node_alloc(node->height - 1);
+      if (!child)
+        return -ENOMEM;
+      radix_tree_publish(node->slots[slot], child);
+      node->count++;
+    }
+    node = child;
+  }
+
+  slot = radix_tree_slot(index, 1);
+  if (node->slots[slot])
+    return -EEXIST;
+  radix_tree_publish(node->slots[slot], item);
+  node->count++;
+  return 0;
+}
+
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+  struct radix_tree_node *node = radix_tree_load(root->rnode);
+
+  if (!node || index > radix_tree_maxindex(node->height))
+    return NULL;
+  while (node->height > 1) {
+    node = radix_tree_load(node->slots[radix_tree_slot(index, node->height)]);
+    if (!node)
+      return NULL;
+  }
+  return radix_tree_load(node->slots[radix_tree_slot(index, 1)]);
+}
+
+void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+{
+  struct radix_tree_node *path[BITS_PER_LONG / RADIX_TREE_MAP_SHIFT + 2];
+  struct radix_tree_node *node = root->rnode;
+  void *item;
+  int depth = 0, slot;
+
+  if (!node || index > radix_tree_maxindex(node->height))
+    return NULL;
+  for (;;) {
+    path[depth++] = node;
+    if (node->height == 1)
+      break;
+    node = node->slots[radix_tree_slot(index, node->height)];
+    if (!node)
+      return NULL;
+  }
+  item = node->slots[radix_tree_slot(index, 1)];
+  if (!item)
+    return NULL;
+
+  /* clear the slot, and free any node that is left empty */
+  while (depth--) {
+    node = path[depth];
+    slot = radix_tree_slot(index, node->height);
+    node->slots[slot] = NULL;
+    if (--node->count)
+      break;
+    free(node); /* and take it out of its parent in turn */
+    if (!depth)
+      root->rnode = NULL;
+  }
+  return item;
+}
+
+static unsigned int radix_tree_gang(struct radix_tree_node *node,
+                                    unsigned long base, unsigned long first,
+                                    void **results, unsigned int max_items,
+                                    unsigned int found)
+{
+  unsigned long span = 1UL << ((node->height - 1) * RADIX_TREE_MAP_SHIFT);
+  unsigned long start;
+  unsigned int i;
+  void *slot;
+
+  for (i = 0; i < RADIX_TREE_MAP_SIZE && found < max_items; i++) {
+    start = base + i * span;
+    if (start + (span - 1) < first) /* all of it comes before first */
+      continue;
+    slot = radix_tree_load(node->slots[i]);
+    if (!slot)
+      continue;
+    if (node->height == 1)
+      results[found++] = slot;
+    else
+      found = radix_tree_gang(slot, start, first, results, max_items, found);
+    if (start + (span - 1) == ULONG_MAX)
+      break;
+  }
+  return found;
+}
+
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root,
+                                    void **results, unsigned long first_index,
+                                    unsigned int max_items)
+{
+  struct radix_tree_node *node = radix_tree_load(root->rnode);
+
+  if (!node || first_index > radix_tree_maxindex(node->height))
+    return 0;
+  return radix_tree_gang(node, 0, first_index, results, max_items, 0);
+}
+
+/*
+ * main.c gathers what punch and truncate take out of a store, and
+ * frees it once lockless readers are done with it. With no RCU here
+ * there are no such readers, so it all goes on the spot.
+ */
+struct my_scull_reap {
+  struct my_scull_store *store;
+};
+
+struct my_scull_reap *my_scull_reap_alloc(struct my_scull_store *store,
+                                          gfp_t gfp)
+{
+  struct my_scull_reap *reap = malloc(sizeof(*reap));
+
+  if (reap)
+    reap->store = store;
+  return reap;
+}
+
+void my_scull_reap_done(struct my_scull_reap *reap)
+{
+  free(reap);
+}
+
+void my_scull_reap_quantum(struct my_scull_reap **reap, void *quantum)
+{
+  my_scull_free_quantum((*reap)->store, quantum);
+  atomic_dec(&(*reap)->store->nr_quanta);
+}
+
+void my_scull_reap_qset(struct my_scull_reap **reap,
+                        struct my_scull_qset *dataptr)
+{
+  struct my_scull_store *store = (*reap)->store;
+  int i;
+
+  for (i = 0; i < store->qset; i++)
+    if (dataptr->data[i])
+      atomic_dec(&store->nr_quanta);
+  atomic_dec(&store->nr_qsets);
+  my_scull_free_qset(store, dataptr);
+}
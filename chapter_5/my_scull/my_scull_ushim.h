@@ -0,0 +1,316 @@
+/*
+ * my_scull_ushim.h -- just enough of the kernel to build store.c in
+ * user space
+ *
+ * Allocation goes to malloc, locks to pthreads and atomics to the gcc
+ * builtins. The "user's" buffers are plain memory, so copying to and
+ * from them is memcpy. The radix tree is a small one of our own in
+ * my_scull_ushim.c, with the same shape as the kernel's. There is no
+ * RCU: nothing may be deleted from a store while others look it up.
+ */
+
+#ifndef _MY_SCULL_USHIM_H_
+#define _MY_SCULL_USHIM_H_
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/types.h>    /* __u64, for my_scull.h */
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef unsigned int gfp_t;
+
+#define BITS_PER_LONG (__SIZEOF_LONG__ * 8)
+
+#define __user
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define min_t(type, x, y) ((type) (x) < (type) (y) ? (type) (x) : (type) (y))
+
+#define container_of(ptr, type, member) \
+  ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define printk printf
+#define KERN_DEBUG   ""
+#define KERN_NOTICE  ""
+#define KERN_WARNING ""
+
+/* only named in my_scull.h's prototypes */
+struct inode;
+struct file;
+struct kiocb;
+struct pipe_inode_info;
+struct vm_area_struct;
+
+/*
+ * Memory
+ */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (1UL << PAGE_SHIFT)
+#define MAX_ORDER  11
+#define KMALLOC_MAX_SIZE (1UL << (MAX_ORDER + PAGE_SHIFT - 1))
+
+#define SMP_CACHE_BYTES 64
+#define ____cacheline_aligned_in_smp __attribute__((aligned(SMP_CACHE_BYTES)))
+
+#define GFP_KERNEL  0
+#define GFP_ATOMIC  0
+#define __GFP_COMP  0
+#define __GFP_ZERO  1
+
+#ifndef ERESTARTSYS
+#define ERESTARTSYS 512
+#endif
+
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kfree(ptr)           free(ptr)
+
+static inline int get_order(unsigned long size)
+{
+  int order = 0;
+
+  while ((PAGE_SIZE << order) < size)
+    order++;
+  return order;
+}
+
+static inline unsigned long __get_free_pages(int flags, int order)
+{
+  void *p = aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+
+  if (p && (flags & __GFP_ZERO))
+    memset(p, 0, PAGE_SIZE << order);
+  return (unsigned long) p;
+}
+
+/* a quantum is its own page here */
+#define virt_to_page(addr) ((void *) (addr))
+#define put_page(page)     free(page)
+
+#define SLAB_HWCACHE_ALIGN 1
+
+struct kmem_cache {
+  size_t size;                /* rounded up to the alignment */
+  size_t align;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name,
+                                                   size_t size, size_t align,
+                                                   unsigned long flags,
+                                                   void (*ctor)(void *))
+{
+  struct kmem_cache *cache = malloc(sizeof(*cache));
+
+  if (!cache)
+    return NULL;
+  if (flags & SLAB_HWCACHE_ALIGN)
+    align = SMP_CACHE_BYTES;
+  cache->align = align > sizeof(void *) ? align : sizeof(void *);
+  cache->size = (size + cache->align - 1) & ~(cache->align - 1);
+  return cache;
+}
+
+#define kmem_cache_alloc(cache, flags) \
+  aligned_alloc((cache)->align, (cache)->size)
+#define kmem_cache_free(cache, ptr)    free(ptr)
+#define kmem_cache_destroy(cache)      free(cache)
+#define kmem_cache_size(cache)         ((cache)->size)
+
+static inline void *kmem_cache_zalloc(struct kmem_cache *cache, int flags)
+{
+  void *p = kmem_cache_alloc(cache, flags);
+
+  if (p)
+    memset(p, 0, cache->size);
+  return p;
+}
+
+/* nothing can fault: they never fail */
+#define copy_to_user(to, from, n)   (memcpy(to, from, n), 0UL)
+#define copy_from_user(to, from, n) (memcpy(to, from, n), 0UL)
+#define clear_user(to, n)           (memset(to, 0, n), 0UL)
+
+/*
+ * Atomics and barriers
+ */
+typedef struct {
+  int counter;
+} atomic_t;
+
+#define atomic_read(v)   __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_inc(v)  __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+#define atomic_dec(v)  __atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+
+#define cmpxchg(ptr, old, new) __sync_val_compare_and_swap(ptr, old, new)
+#define xchg(ptr, v) __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST)
+#define ACCESS_ONCE(x) (*(volatile __typeof__(x) *) &(x))
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#define rcu_read_lock()   do { } while (0)
+#define rcu_read_unlock() do { } while (0)
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define srcu_dereference(p, sp) rcu_dereference(p)
+
+/* there is only one "CPU" worth of statistics */
+#define this_cpu_add(pcp, n) __atomic_add_fetch(&(pcp), (n), __ATOMIC_RELAXED)
+#define this_cpu_inc(pcp)    this_cpu_add(pcp, 1)
+
+/*
+ * Locks, and the rest of what struct my_scull_dev is made of
+ */
+typedef pthread_spinlock_t spinlock_t;
+#define spin_lock_init(lock) pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(lock)      pthread_spin_lock(lock)
+#define spin_unlock(lock)    pthread_spin_unlock(lock)
+
+struct mutex {
+  pthread_mutex_t m;
+};
+#define DEFINE_MUTEX(lock) struct mutex lock = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(lock)   pthread_mutex_init(&(lock)->m, NULL)
+#define mutex_lock(lock)   pthread_mutex_lock(&(lock)->m)
+#define mutex_unlock(lock) pthread_mutex_unlock(&(lock)->m)
+#define mutex_trylock(lock) (pthread_mutex_trylock(&(lock)->m) == 0)
+#define mutex_lock_interruptible(lock) (mutex_lock(lock), 0) /* no signals */
+
+typedef struct {
+  unsigned int sequence;
+} seqcount_t;
+
+#define seqcount_init(s) ((s)->sequence = 0)
+
+static inline unsigned int read_seqcount_begin(seqcount_t *s)
+{
+  unsigned int seq;
+
+  while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+    ;
+  return seq;
+}
+
+static inline int read_seqcount_retry(seqcount_t *s, unsigned int seq)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+  __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+  __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+struct work_struct {
+  void (*func)(struct work_struct *work);
+};
+#define INIT_WORK(work, fn) ((work)->func = NULL) /* never queued here */
+
+struct srcu_struct {
+  int unused;
+};
+
+struct rw_semaphore {
+  pthread_rwlock_t lock;
+};
+#define init_rwsem(sem) pthread_rwlock_init(&(sem)->lock, NULL)
+#define down_read(sem)  pthread_rwlock_rdlock(&(sem)->lock)
+#define up_read(sem)    pthread_rwlock_unlock(&(sem)->lock)
+#define down_write(sem) pthread_rwlock_wrlock(&(sem)->lock)
+#define up_write(sem)   pthread_rwlock_unlock(&(sem)->lock)
+
+struct cdev {
+  dev_t dev;
+};
+
+#define MINOR(dev) ((unsigned int) ((dev) & 0xfffff))
+
+#define cond_resched() do { } while (0)
+
+/*
+ * Time, for the lock statistics
+ */
+static inline u64 ktime_get(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define ktime_to_ns(t) (t)
+
+/*
+ * Arithmetic
+ */
+#define is_power_of_2(n) ((n) != 0 && ((n) & ((n) - 1)) == 0)
+#define ilog2(n)         (63 - __builtin_clzll(n))
+
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+  *remainder = dividend % divisor;
+  return dividend / divisor;
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+  return dividend / divisor;
+}
+
+/*
+ * The radix tree, see my_scull_ushim.c
+ */
+struct radix_tree_node;
+
+struct radix_tree_root {
+  struct radix_tree_node *rnode;
+};
+
+#define INIT_RADIX_TREE(root, mask) ((root)->rnode = NULL)
+
+static inline int radix_tree_preload(int gfp_mask)
+{
+  return 0; /* nodes are allocated as they are needed */
+}
+
+static inline void radix_tree_preload_end(void)
+{
+}
+
+int      radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+                           void *item);
+void    *radix_tree_lookup(struct radix_tree_root *root, unsigned long index);
+void    *radix_tree_delete(struct radix_tree_root *root, unsigned long index);
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root,
+                                    void **results, unsigned long first_index,
+                                    unsigned int max_items);
+
+/*
+ * No trace events in user space
+ */
+#define trace_my_scull_follow_enter(minor, item)       do { } while (0)
+#define trace_my_scull_follow_exit(minor, item, qset)  do { } while (0)
+#define trace_my_scull_lock_acquire(minor, lock, wait) do { (void) (wait); } while (0)
+#define trace_my_scull_lock_release(minor, lock)       do { } while (0)
+
+#define MY_SCULL_LOCK_QSET 1 /* as in my_scull_trace.h */
+
+#endif /* _MY_SCULL_USHIM_H_ */
@@ -0,0 +1,334 @@
+/*
+ * pipe.c -- fifo driver for my_scull
+ *
+ * Each pipe device is a ring buffer between exactly one reader and one
+ * writer. With only one of each, the two sides share no lock: the
+ * writer is the only one to move the head and the reader the only one
+ * to move the tail, and barriers keep each side from running into the
+ * other. Threads sharing the one reading (or writing) file still queue
+ * on that side's own mutex.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+#include <linux/kernel.h>   /* printk, container_of, min */
+#include <linux/slab.h>     /* kmalloc */
+#include <linux/vmalloc.h>  /* the ring itself */
+#include <linux/fs.h>       /* everything... */
+#include <linux/types.h>    /* size_t, dev_t */
+#include <linux/string.h>   /* memset */
+#include <linux/cdev.h>     /* cdev */
+#include <linux/mutex.h>    /* open/release bookkeeping, each side's threads */
+#include <linux/sched.h>    /* wait queues */
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/log2.h>     /* roundup_pow_of_two */
+
+#include <asm/uaccess.h>    /* copy_*_user */
+
+#include "my_scull.h"
+
+struct my_scull_pipe {
+  /* the writer's side */
+  unsigned long head ____cacheline_aligned_in_smp; /* bytes ever written */
+  wait_queue_head_t inq;      /* where the reader waits for data */
+  struct mutex wlock;         /* one write at a time moves head */
+
+  /* the reader's side, on its own cache line */
+  unsigned long tail ____cacheline_aligned_in_smp; /* bytes ever read */
+  wait_queue_head_t outq;     /* where the writer waits for room */
+  struct mutex rlock;         /* one read at a time moves tail */
+
+  /* set up at open, read-only while the pipe is in use */
+  char *buffer ____cacheline_aligned_in_smp;
+  unsigned long size;         /* power of two, so head and tail can wrap */
+  int nreaders, nwriters;     /* never more than one of each */
+  struct mutex lock;          /* for open and release */
+  struct cdev cdev;           /* char device structure */
+};
+
+/* parameters */
+static int my_scull_p_nr_devs = MY_SCULL_P_NR_DEVS; /* number of pipe devices */
+int my_scull_p_buffer = MY_SCULL_P_BUFFER;          /* buffer size */
+dev_t my_scull_p_devno;                             /* our first device number */
+
+module_param(my_scull_p_nr_devs, int, S_IRUGO);
+module_param(my_scull_p_buffer, int, S_IRUGO);
+
+static struct my_scull_pipe *my_scull_p_devices;
+
+/*
+ * The writer is only woken once a quarter of the ring is free again,
+ * so a writer that fills the ring sleeps once per batch rather than
+ * once per read.
+ */
+#define MY_SCULL_P_WAKE(dev) ((dev)->size / 4)
+
+/*
+ * Open and close
+ */
+static int my_scull_p_open(struct inode *inode, struct file *filp)
+{
+  struct my_scull_pipe *dev;
+
+  dev = container_of(inode->i_cdev, struct my_scull_pipe, cdev);
+  filp->private_data = dev;
+
+  if (mutex_lock_interruptible(&dev->lock))
+    return -ERESTARTSYS;
+
+  /* one reader and one writer, that is what lets the ring go unlocked */
+  if (((filp->f_mode & FMODE_READ) && dev->nreaders) ||
+      ((filp->f_mode & FMODE_WRITE) && dev->nwriters)) {
+    mutex_unlock(&dev->lock);
+    return -EBUSY;
+  }
+
+  if (!dev->buffer) {
+    /* allocate the buffer */
+    dev->size = roundup_pow_of_two(my_scull_p_buffer);
+    dev->buffer = vmalloc(dev->size);
+    if (!dev->buffer) {
+      mutex_unlock(&dev->lock);
+      return -ENOMEM;
+    }
+    dev->head = dev->tail = 0;
+  }
+
+  if (filp->f_mode & FMODE_READ)
+    dev->nreaders++;
+  if (filp->f_mode & FMODE_WRITE)
+    dev->nwriters++;
+  mutex_unlock(&dev->lock);
+
+  return nonseekable_open(inode, filp);
+}
+
+static int my_scull_p_release(struct inode *inode, struct file *filp)
+{
+  struct my_scull_pipe *dev = filp->private_data;
+
+  mutex_lock(&dev->lock);
+  if (filp->f_mode & FMODE_READ)
+    dev->nreaders--;
+  if (filp->f_mode & FMODE_WRITE)
+    dev->nwriters--;
+  if (dev->nreaders + dev->nwriters == 0) {
+    vfree(dev->buffer);
+    dev->buffer = NULL; /* the other fields are not checked on open */
+  }
+  mutex_unlock(&dev->lock);
+  return 0;
+}
+
+/*
+ * Data management: read and write
+ */
+
+static ssize_t my_scull_p_read(struct file *filp, char __user *buf,
+                               size_t count, loff_t *f_pos)
+{
+  struct my_scull_pipe *dev = filp->private_data;
+  unsigned long head, tail, off;
+  size_t chunk;
+  ssize_t retval;
+
+  /* other threads reading through this file wait their turn */
+  if (filp->f_flags & O_NONBLOCK) {
+    if (!mutex_trylock(&dev->rlock))
+      return -EAGAIN;
+  } else if (mutex_lock_interruptible(&dev->rlock)) {
+    return -ERESTARTSYS;
+  }
+  tail = dev->tail; /* only we move it */
+
+  while ((head = ACCESS_ONCE(dev->head)) == tail) { /* nothing to read */
+    retval = -EAGAIN;
+    if (filp->f_flags & O_NONBLOCK)
+      goto out;
+    PDEBUG("\"%s\" reading: going to sleep\n", current->comm);
+    retval = -ERESTARTSYS; /* signal: tell the fs layer to handle it */
+    if (wait_event_interruptible(dev->inq, ACCESS_ONCE(dev->head) != tail))
+      goto out;
+  }
+  smp_rmb(); /* see the data the writer put in before moving head */
+
+  /* ok, data is there, return something */
+  count = min_t(size_t, count, head - tail);
+  off = tail & (dev->size - 1);
+  chunk = min_t(size_t, count, dev->size - off); /* up to the wrap... */
+  retval = -EFAULT;
+  if (copy_to_user(buf, dev->buffer + off, chunk) ||
+      copy_to_user(buf + chunk, dev->buffer, count - chunk)) /* ...and past it */
+    goto out;
+
+  /* finish reading before the writer may reuse the space */
+  smp_mb();
+  dev->tail = tail + count;
+
+  /* finally, awake the writer, if there is one and it's worth it */
+  smp_mb();
+  if (waitqueue_active(&dev->outq) &&
+      dev->size - (ACCESS_ONCE(dev->head) - dev->tail) >= MY_SCULL_P_WAKE(dev))
+    wake_up_interruptible(&dev->outq);
+
+  PDEBUG("\"%s\" did read %li bytes\n", current->comm, (long) count);
+  retval = count;
+ out:
+  mutex_unlock(&dev->rlock);
+  return retval;
+}
+
+static ssize_t my_scull_p_write(struct file *filp, const char __user *buf,
+                                size_t count, loff_t *f_pos)
+{
+  struct my_scull_pipe *dev = filp->private_data;
+  unsigned long head, tail, off;
+  size_t chunk;
+  ssize_t retval;
+
+  /* as for read, one thread at a time on this side */
+  if (filp->f_flags & O_NONBLOCK) {
+    if (!mutex_trylock(&dev->wlock))
+      return -EAGAIN;
+  } else if (mutex_lock_interruptible(&dev->wlock)) {
+    return -ERESTARTSYS;
+  }
+  head = dev->head; /* only we move it */
+
+  while (head - (tail = ACCESS_ONCE(dev->tail)) == dev->size) { /* full */
+    retval = -EAGAIN;
+    if (filp->f_flags & O_NONBLOCK)
+      goto out;
+    PDEBUG("\"%s\" writing: going to sleep\n", current->comm);
+    retval = -ERESTARTSYS; /* signal: tell the fs layer to handle it */
+    if (wait_event_interruptible(dev->outq,
+                                 head - ACCESS_ONCE(dev->tail) != dev->size))
+      goto out;
+  }
+  smp_mb(); /* don't overwrite what the reader hasn't finished with */
+
+  /* ok, space is there, accept something */
+  count = min_t(size_t, count, dev->size - (head - tail));
+  off = head & (dev->size - 1);
+  chunk = min_t(size_t, count, dev->size - off);
+  retval = -EFAULT;
+  if (copy_from_user(dev->buffer + off, buf, chunk) ||
+      copy_from_user(dev->buffer, buf + chunk, count - chunk))
+    goto out;
+
+  /* the data must be there before the reader can see head move */
+  smp_wmb();
+  dev->head = head + count;
+
+  /* finally, awake any reader: it only sleeps on an empty ring */
+  smp_mb();
+  if (waitqueue_active(&dev->inq))
+    wake_up_interruptible(&dev->inq);
+
+  PDEBUG("\"%s\" did write %li bytes\n", current->comm, (long) count);
+  retval = count;
+ out:
+  mutex_unlock(&dev->wlock);
+  return retval;
+}
+
+static unsigned int my_scull_p_poll(struct file *filp, poll_table *wait)
+{
+  struct my_scull_pipe *dev = filp->private_data;
+  unsigned long used;
+  unsigned int mask = 0;
+
+  poll_wait(filp, &dev->inq, wait);
+  poll_wait(filp, &dev->outq, wait);
+  used = ACCESS_ONCE(dev->head) - ACCESS_ONCE(dev->tail);
+  if (used)
+    mask |= POLLIN | POLLRDNORM;  /* readable */
+  if (used != dev->size)
+    mask |= POLLOUT | POLLWRNORM; /* writable */
+  return mask;
+}
+
+/*
+ * The file operations for the pipe device
+ */
+static const struct file_operations my_scull_pipe_fops = {
+  .owner   = THIS_MODULE,
+  .llseek  = no_llseek,
+  .read    = my_scull_p_read,
+  .write   = my_scull_p_write,
+  .poll    = my_scull_p_poll,
+  .open    = my_scull_p_open,
+  .release = my_scull_p_release,
+};
+
+/*
+ * Set up a cdev entry.
+ */
+static void my_scull_p_setup_cdev(struct my_scull_pipe *dev, int index)
+{
+  int err, devno = my_scull_p_devno + index;
+
+  cdev_init(&dev->cdev, &my_scull_pipe_fops);
+  dev->cdev.owner = THIS_MODULE;
+  err = cdev_add(&dev->cdev, devno, 1);
+  /* Fail gracefully if need be */
+  if (err)
+    printk(KERN_NOTICE "Error %d adding my_scullpipe%d", err, index);
+}
+
+/*
+ * Initialize the pipe devs; return how many we did.
+ */
+int my_scull_p_init(dev_t firstdev)
+{
+  int i, result;
+
+  if (my_scull_p_buffer <= 0) {
+    printk(KERN_NOTICE "my_scullp: bad buffer size %d\n", my_scull_p_buffer);
+    return 0;
+  }
+  result = register_chrdev_region(firstdev, my_scull_p_nr_devs, "my_scullp");
+  if (result < 0) {
+    printk(KERN_NOTICE "Unable to get my_scullp region, error %d\n", result);
+    return 0;
+  }
+  my_scull_p_devno = firstdev;
+  my_scull_p_devices = kmalloc(my_scull_p_nr_devs * sizeof(struct my_scull_pipe),
+                               GFP_KERNEL);
+  if (my_scull_p_devices == NULL) {
+    unregister_chrdev_region(firstdev, my_scull_p_nr_devs);
+    return 0;
+  }
+  memset(my_scull_p_devices, 0, my_scull_p_nr_devs * sizeof(struct my_scull_pipe));
+  for (i = 0; i < my_scull_p_nr_devs; i++) {
+    init_waitqueue_head(&(my_scull_p_devices[i].inq));
+    init_waitqueue_head(&(my_scull_p_devices[i].outq));
+    mutex_init(&my_scull_p_devices[i].lock);
+    mutex_init(&my_scull_p_devices[i].rlock);
+    mutex_init(&my_scull_p_devices[i].wlock);
+    my_scull_p_setup_cdev(my_scull_p_devices + i, i);
+  }
+  return my_scull_p_nr_devs;
+}
+
+/*
+ * This is called by cleanup_module or on failure.
+ * It is required to never fail, even if nothing was initialized first
+ */
+void my_scull_p_cleanup(void)
+{
+  int i;
+
+  if (!my_scull_p_devices)
+    return; /* nothing else to release */
+
+  for (i = 0; i < my_scull_p_nr_devs; i++) {
+    cdev_del(&my_scull_p_devices[i].cdev);
+    vfree(my_scull_p_devices[i].buffer);
+  }
+  kfree(my_scull_p_devices);
+  unregister_chrdev_region(my_scull_p_devno, my_scull_p_nr_devs);
+  my_scull_p_devices = NULL; /* pedantic */
+}
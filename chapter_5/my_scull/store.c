@@ -0,0 +1,779 @@
+/*
+ * store.c -- where the my_scull devices keep their data
+ *
+ * A store is an index of quantum sets, each an array of pointers to
+ * quanta. Everything here works on a store alone, the reads and writes
+ * included: locking the device, and freeing what readers may still be
+ * looking at, are up to main.c.
+ *
+ * This file also builds as plain user space code, against
+ * my_scull_ushim.h, so that the data structures can be measured with
+ * the usual tools, checked, and tried out at random. The shim's
+ * copy_to_user and friends are plain memcpy. See my_scull_store_bench.c,
+ * my_scull_store_test.c and my_scull_store_fuzz.c.
+ */
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>   /* container_of */
+#include <linux/slab.h>     /* kmalloc, kmem_cache */
+#include <linux/mm.h>       /* __get_free_pages */
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/string.h>   /* memset */
+#include <linux/cdev.h>
+#include <linux/radix-tree.h> /* the quantum set index */
+#include <linux/rcupdate.h> /* rcu_read_lock, for the index */
+#include <linux/srcu.h>
+#include <linux/mutex.h>    /* the quantum caches, quantum set locks */
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>    /* cond_resched */
+#include <linux/math64.h>
+#include <linux/seqlock.h>
+#include <linux/log2.h>     /* power-of-two geometry */
+#include <linux/uio.h>      /* struct iovec */
+#include <linux/ktime.h>
+#include <asm/uaccess.h>    /* copy_*_user */
+
+#include "my_scull.h"
+#include "my_scull_store.h"
+#include "my_scull_trace.h"
+
+#else /* user space */
+
+#include "my_scull_ushim.h"
+#include "my_scull.h"
+#include "my_scull_store.h"
+
+#endif
+
+/*
+ * Quantum sets get a cache of their own, sized exactly, rather than
+ * rounding up into the generic kmalloc ones. It fits the qset the
+ * module was loaded with; a store with any other geometry falls back
+ * on kmalloc. Nodes start on a cache line, so a lookup that wants
+ * one of the first few quanta touches just the one line.
+ */
+static struct kmem_cache *my_scull_qset_cache;
+static int my_scull_cache_qset; /* what my_scull_qset_cache is sized for */
+
+static size_t my_scull_qset_size(int qset)
+{
+  return sizeof(struct my_scull_qset) + qset * sizeof(void *);
+}
+
+static void my_scull_count_alloc(struct my_scull_dev *dev, void *ptr)
+{
+  if (ptr)
+    MY_SCULL_STAT_INC(dev, allocs);
+  else
+    MY_SCULL_STAT_INC(dev, alloc_fails);
+}
+
+/*
+ * Quanta made of whole pages are page allocations rather than kmalloc
+ * buffers, so that they can be mapped into user space. They are
+ * compound so that the pages of a multi-page quantum can be handed out
+ * one at a time. Memory is zeroed as a mapping exposes all of it, not
+ * just the part that was written, and holes inside a quantum must read
+ * back as zeros anyway.
+ *
+ * Any other quantum would waste the rest of its last page, so it comes
+ * from a cache sized to it instead. The caches are shared by all the
+ * stores with that quantum and kept until the module goes. Past
+ * MY_SCULL_QUANTUM_CACHES different sizes, quanta fall back on kmalloc.
+ */
+#define MY_SCULL_QUANTUM_CACHES 8
+
+static struct {
+  int quantum;
+  char name[32];              /* the cache keeps a pointer to it */
+  struct kmem_cache *cache;
+} my_scull_quantum_caches[MY_SCULL_QUANTUM_CACHES];
+static DEFINE_MUTEX(my_scull_quantum_cache_lock);
+
+/* the cache for this size of quantum, made if need be, or NULL */
+static struct kmem_cache *my_scull_quantum_cache(int quantum)
+{
+  struct kmem_cache *cache = NULL;
+  int i;
+
+  mutex_lock(&my_scull_quantum_cache_lock);
+  for (i = 0; i < MY_SCULL_QUANTUM_CACHES; i++) {
+    if (my_scull_quantum_caches[i].quantum == quantum) {
+      cache = my_scull_quantum_caches[i].cache;
+      break;
+    }
+    if (!my_scull_quantum_caches[i].quantum) { /* a free slot: make one */
+      snprintf(my_scull_quantum_caches[i].name,
+               sizeof(my_scull_quantum_caches[i].name),
+               "my_scull_quantum_%i", quantum);
+      cache = kmem_cache_create(my_scull_quantum_caches[i].name, quantum, 0,
+                                0, NULL);
+      if (cache) {
+        my_scull_quantum_caches[i].quantum = quantum;
+        my_scull_quantum_caches[i].cache = cache;
+      }
+      break;
+    }
+  }
+  mutex_unlock(&my_scull_quantum_cache_lock);
+  return cache;
+}
+
+static void *my_scull_alloc_quantum(struct my_scull_store *store)
+{
+  void *quantum;
+
+  if (my_scull_page_quanta(store))
+    quantum = (void *) __get_free_pages(GFP_KERNEL | __GFP_COMP | __GFP_ZERO,
+                                        get_order(store->quantum));
+  else if (store->quantum_cache)
+    quantum = kmem_cache_zalloc(store->quantum_cache, GFP_KERNEL);
+  else
+    quantum = kzalloc(store->quantum, GFP_KERNEL);
+  my_scull_count_alloc(store->dev, quantum);
+  return quantum;
+}
+
+/*
+ * A page quantum is let go of by dropping our reference rather than
+ * freeing it outright: a pipe may still be holding on to its pages,
+ * and a page spliced in from someone else must go back the way it came.
+ */
+void my_scull_free_quantum(struct my_scull_store *store, void *quantum)
+{
+  if (!quantum)
+    return;
+  if (my_scull_page_quanta(store))
+    put_page(virt_to_page(quantum));
+  else if (store->quantum_cache)
+    kmem_cache_free(store->quantum_cache, quantum);
+  else
+    kfree(quantum);
+}
+
+/* what a quantum really takes up */
+static size_t my_scull_quantum_size(struct my_scull_store *store)
+{
+  if (my_scull_page_quanta(store))
+    return PAGE_SIZE << get_order(store->quantum);
+  if (store->quantum_cache)
+    return kmem_cache_size(store->quantum_cache);
+  return store->quantum; /* and whatever kmalloc rounds it up by */
+}
+
+static struct my_scull_qset *my_scull_alloc_qset(struct my_scull_store *store)
+{
+  struct my_scull_qset *qs;
+
+  if (store->qset == my_scull_cache_qset)
+    qs = kmem_cache_alloc(my_scull_qset_cache, GFP_KERNEL);
+  else
+    qs = kmalloc(my_scull_qset_size(store->qset), GFP_KERNEL);
+  if (qs)
+    memset(qs, 0, my_scull_qset_size(store->qset));
+  my_scull_count_alloc(store->dev, qs);
+  return qs;
+}
+
+/* just the node, see my_scull_free_qset for the quanta too */
+static void my_scull_release_qset(struct my_scull_store *store,
+                                  struct my_scull_qset *qs)
+{
+  if (store->qset == my_scull_cache_qset)
+    kmem_cache_free(my_scull_qset_cache, qs);
+  else
+    kfree(qs);
+}
+
+/*
+ * How much memory a store has taken to hold its data
+ */
+u64 my_scull_footprint(struct my_scull_store *store)
+{
+  return (u64) atomic_read(&store->nr_qsets) * my_scull_qset_size(store->qset) +
+    (u64) atomic_read(&store->nr_quanta) * my_scull_quantum_size(store);
+}
+
+/*
+ * Can the store hold data up to end? List items are numbered with an
+ * unsigned long, which a 32-bit machine runs out of long before loff_t.
+ */
+int my_scull_in_range(struct my_scull_store *store, loff_t end)
+{
+  return end <= 0 ||
+    div_u64(end - 1, (u32) store->quantum * store->qset) <= ULONG_MAX;
+}
+
+/*
+ * Is this a geometry we can work with? A list item has to fit in
+ * 32 bits for my_scull_decode, a quantum set node in one kmalloc and
+ * a quantum in one __get_free_pages.
+ */
+int my_scull_geometry_ok(int quantum, int qset)
+{
+  return quantum > 0 && qset > 0 && (u64) quantum * qset <= UINT_MAX &&
+    qset <= (KMALLOC_MAX_SIZE - sizeof(struct my_scull_qset)) / sizeof(void *) &&
+    get_order(quantum) < MAX_ORDER;
+}
+
+/*
+ * Make a new, empty store for dev with the geometry given
+ */
+struct my_scull_store *my_scull_alloc_store(struct my_scull_dev *dev,
+                                            int quantum, int qset)
+{
+  struct my_scull_store *store;
+
+  store = kmalloc(sizeof(struct my_scull_store), GFP_KERNEL);
+  if (!store)
+    return NULL;
+  memset(store, 0, sizeof(struct my_scull_store));
+  INIT_RADIX_TREE(&store->index, GFP_ATOMIC); /* inserts are preloaded */
+  spin_lock_init(&store->lock);
+#if BITS_PER_LONG == 32
+  seqcount_init(&store->size_seq);
+#endif
+  INIT_WORK(&store->free_work, my_scull_free_store_work);
+  atomic_set(&store->refs, 1); /* for the device, once we are its store */
+  store->dev = dev;
+  store->quantum = quantum;
+  store->qset = qset;
+  store->pow2 = is_power_of_2(quantum) && is_power_of_2(qset);
+  if (store->pow2) {
+    store->quantum_shift = ilog2(quantum);
+    store->item_shift = ilog2(quantum) + ilog2(qset);
+  }
+  if (!my_scull_page_quanta(store))
+    store->quantum_cache = my_scull_quantum_cache(quantum);
+  return store;
+}
+
+/*
+ * Free a quantum set that is no longer in the index, with its quanta
+ */
+void my_scull_free_qset(struct my_scull_store *store,
+                        struct my_scull_qset *dataptr)
+{
+  int i;
+
+  for (i = 0; i < store->qset; i++)
+    my_scull_free_quantum(store, dataptr->data[i]); /* free the quantum */
+  my_scull_release_qset(store, dataptr); /* free the qset, pointers and all */
+}
+
+/*
+ * Free a store and everything in it. Nobody may be looking at it any
+ * more: it must have been unpublished and the readers waited for.
+ */
+void my_scull_free_store(struct my_scull_store *store)
+{
+  struct my_scull_qset *batch[MY_SCULL_GANG];
+  unsigned int n, j;
+
+  /* everything we find gets deleted, so always restart from item 0 */
+  while ((n = radix_tree_gang_lookup(&store->index, (void **) batch,
+                                     0, MY_SCULL_GANG))) {
+    for (j = 0; j < n; j++) {
+      radix_tree_delete(&store->index, batch[j]->item);
+      my_scull_free_qset(store, batch[j]);
+    }
+    cond_resched(); /* a big store takes a while, let others in */
+  }
+  kfree(store);
+}
+
+/*
+ * Find the first quantum set at or after list item "first", or NULL
+ */
+struct my_scull_qset *my_scull_next_qset(struct my_scull_store *store,
+                                         unsigned long first)
+{
+  struct my_scull_qset *qs;
+  unsigned int found;
+
+  rcu_read_lock(); /* writers may be adding to the index */
+  found = radix_tree_gang_lookup(&store->index, (void **) &qs, first, 1);
+  rcu_read_unlock();
+  return found ? qs : NULL;
+}
+
+/*
+ * Find list item n, allocating it (and only it) if need be. Only the
+ * insertion into the index is done under store->lock, so concurrent
+ * callers may race to create the same item: the loser frees its copy
+ * and uses the winner's.
+ */
+struct my_scull_qset *my_scull_follow(struct my_scull_store *store,
+                                      unsigned long n)
+{
+  struct my_scull_qset *qs;
+  int err;
+
+  trace_my_scull_follow_enter(MY_SCULL_MINOR(store->dev), n);
+  qs = my_scull_lookup(store, n);
+  if (qs)
+    goto out;
+
+  qs = my_scull_alloc_qset(store);
+  if (qs == NULL)
+    goto out;
+  mutex_init(&qs->lock);
+  qs->item = n;
+
+  /* get the index nodes now, we can't sleep under the spinlock */
+  if (radix_tree_preload(GFP_KERNEL)) {
+    my_scull_release_qset(store, qs);
+    qs = NULL;
+    goto out;
+  }
+  spin_lock(&store->lock);
+  err = radix_tree_insert(&store->index, n, qs); /* publishes qs to readers */
+  spin_unlock(&store->lock);
+  radix_tree_preload_end();
+
+  if (err) {
+    my_scull_release_qset(store, qs);
+    qs = (err == -EEXIST) ? my_scull_lookup(store, n) : NULL;
+  } else {
+    atomic_inc(&store->nr_qsets);
+  }
+
+ out:
+  trace_my_scull_follow_exit(MY_SCULL_MINOR(store->dev), n, qs);
+  return qs;
+}
+
+/*
+ * Make sure quantum s_pos of a list item exists, allocating it if need
+ * be. Returns the quantum, or NULL if we ran out of memory.
+ *
+ * No lock is needed: each pointer is installed with cmpxchg, which also
+ * orders the zeroed memory before the pointer for lockless readers. If
+ * somebody else got there first we free ours and use theirs.
+ */
+void *my_scull_fill(struct my_scull_store *store,
+                    struct my_scull_qset *dataptr, int s_pos)
+{
+  void **data = dataptr->data;
+  void *quantum, *other;
+
+  /* allocate memory for the quantum if need be */
+  quantum = ACCESS_ONCE(data[s_pos]);
+  if (!quantum) {
+    quantum = my_scull_alloc_quantum(store);
+    if (!quantum)
+      return NULL;
+    other = cmpxchg(&data[s_pos], NULL, quantum);
+    if (other) {
+      my_scull_free_quantum(store, quantum);
+      quantum = other;
+    } else {
+      atomic_inc(&store->nr_quanta);
+    }
+  }
+  return quantum;
+}
+
+/*
+ * Raise the size to cover everything up to end, only once readers can
+ * see the data under it.
+ */
+void my_scull_grow(struct my_scull_store *store, loff_t end)
+{
+  spin_lock(&store->lock);
+  if (store->size < end) {
+    smp_wmb();
+    my_scull_set_size(store, end);
+  }
+  spin_unlock(&store->lock);
+}
+
+/* step a cursor over the user's buffers along */
+static void my_scull_iov_advance(struct my_scull_iov *it, size_t n)
+{
+  it->offset += n;
+  if (it->offset == it->iov->iov_len) {
+    it->iov++;
+    it->nr_segs--;
+    it->offset = 0;
+  }
+}
+
+/*
+ * Copy len bytes out to the user's buffers. Returns how many made it,
+ * which is less than len only if we hit a bad address.
+ */
+static size_t my_scull_copy_to_iov(struct my_scull_iov *it,
+                                   const void *from, size_t len)
+{
+  size_t n, left, done = 0;
+
+  while (done < len && it->nr_segs) {
+    n = min_t(size_t, len - done, it->iov->iov_len - it->offset);
+    left = copy_to_user(it->iov->iov_base + it->offset, from + done, n);
+    done += n - left;
+    my_scull_iov_advance(it, n - left);
+    if (left)
+      break;
+  }
+  return done;
+}
+
+/* the same for a hole, which reads back as zeros */
+static size_t my_scull_zero_iov(struct my_scull_iov *it, size_t len)
+{
+  size_t n, left, done = 0;
+
+  while (done < len && it->nr_segs) {
+    n = min_t(size_t, len - done, it->iov->iov_len - it->offset);
+    left = clear_user(it->iov->iov_base + it->offset, n);
+    done += n - left;
+    my_scull_iov_advance(it, n - left);
+    if (left)
+      break;
+  }
+  return done;
+}
+
+static size_t my_scull_copy_from_iov(struct my_scull_iov *it,
+                                     void *to, size_t len)
+{
+  size_t n, left, done = 0;
+
+  while (done < len && it->nr_segs) {
+    n = min_t(size_t, len - done, it->iov->iov_len - it->offset);
+    left = copy_from_user(to + done, it->iov->iov_base + it->offset, n);
+    done += n - left;
+    my_scull_iov_advance(it, n - left);
+    if (left)
+      break;
+  }
+  return done;
+}
+
+/*
+ * A quantum set's lock, counted and traced like dev->sem
+ */
+static int my_scull_qset_lock(struct my_scull_dev *dev,
+                              struct my_scull_qset *dataptr, int nonblock)
+{
+  u64 start, wait = 0;
+
+  if (!mutex_trylock(&dataptr->lock)) {
+    if (nonblock)
+      return -EAGAIN;
+    MY_SCULL_STAT_INC(dev, lock_waits);
+    start = my_scull_now();
+    if (mutex_lock_interruptible(&dataptr->lock))
+      return -ERESTARTSYS;
+    wait = my_scull_now() - start;
+  }
+  trace_my_scull_lock_acquire(MY_SCULL_MINOR(dev), MY_SCULL_LOCK_QSET, wait);
+  return 0;
+}
+
+static void my_scull_qset_unlock(struct my_scull_dev *dev,
+                                 struct my_scull_qset *dataptr)
+{
+  trace_my_scull_lock_release(MY_SCULL_MINOR(dev), MY_SCULL_LOCK_QSET);
+  mutex_unlock(&dataptr->lock);
+}
+
+/*
+ * Read count bytes at pos into the user's buffers. Returns how many,
+ * short at the end of the data, or -EFAULT if not even one made it.
+ *
+ * Nothing is locked: the caller only keeps the store from being freed,
+ * through dev->srcu, and whatever a writer is in the middle of reads
+ * back as zeros or as what it wrote.
+ */
+ssize_t my_scull_store_read(struct my_scull_store *store,
+                            struct my_scull_iov *it, loff_t pos, size_t count)
+{
+  struct my_scull_qset *dataptr;
+  void **data = NULL;                            /* the current listitem's quanta */
+  void *quantum_ptr;
+  int quantum = store->quantum, qset = store->qset;
+  unsigned long item;                            /* listitem - index into my_scull_qset list */
+  int s_pos, q_pos;                              /* index into quantum set, and into quantum */
+  loff_t size;
+  size_t chunk, copied, done = 0;
+  int looked = 0;
+
+  size = my_scull_size(store);
+  smp_rmb(); /* don't read the data before the size that covers it */
+  if (pos >= size)
+    return 0;
+  if (pos + count > size)
+    count = size - pos;
+
+  my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+
+  /*
+   * Copy quantum by quantum until the request is satisfied. Only the
+   * first position needs dividing out, after that we just step along.
+   */
+  while (done < count) {
+    /* look the list item up, don't allocate anything for a read */
+    if (!looked) {
+      dataptr = my_scull_lookup(store, item);
+      data = dataptr ? dataptr->data : NULL;
+      looked = 1;
+    }
+    quantum_ptr = data ? srcu_dereference(data[s_pos], &store->dev->srcu) : NULL;
+
+    /* read up to the end of this quantum, or zeros if it's a hole */
+    chunk = min_t(size_t, count - done, quantum - q_pos);
+    if (quantum_ptr)
+      copied = my_scull_copy_to_iov(it, quantum_ptr + q_pos, chunk);
+    else
+      copied = my_scull_zero_iov(it, chunk);
+    done += copied;
+    if (copied < chunk)
+      return done ? done : -EFAULT;
+
+    /* move on to the start of the next quantum */
+    q_pos = 0;
+    if (++s_pos == qset) {
+      s_pos = 0;
+      item++;
+      looked = 0;
+    }
+  }
+  return done;
+}
+
+/*
+ * Write count bytes at pos from the user's buffers, allocating as we
+ * go. Each quantum set is locked while it is written, and the size
+ * raised once it is all there. A short write still counts; the error
+ * only comes back if nothing was written.
+ *
+ * The caller keeps the store from being taken apart meanwhile, which
+ * main.c does by holding dev->sem shared.
+ */
+ssize_t my_scull_store_write(struct my_scull_store *store,
+                             struct my_scull_iov *it, loff_t pos,
+                             size_t count, int nonblock)
+{
+  struct my_scull_qset *dataptr = NULL;          /* the current list item */
+  void *quantum_ptr;
+  int quantum = store->quantum, qset = store->qset;
+  unsigned long item;                            /* listitem - index into my_scull_qset list */
+  int s_pos, q_pos;                              /* index into quantum set, and into quantum */
+  size_t chunk, copied, done = 0;
+  ssize_t retval = -ENOMEM;
+  int err;
+
+  if (!my_scull_in_range(store, pos + count))
+    return -EFBIG;
+  my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+
+  /* as for read, fill quantum by quantum until everything is written */
+  while (done < count) {
+    /* find the list item, allocating it if need be, and lock it */
+    if (!dataptr) {
+      dataptr = my_scull_follow(store, item);
+      if (dataptr == NULL)
+        break;
+      err = my_scull_qset_lock(store->dev, dataptr, nonblock);
+      if (err) {
+        dataptr = NULL;
+        retval = err;
+        break;
+      }
+      my_scull_touch(store, dataptr);
+    }
+
+    quantum_ptr = my_scull_fill(store, dataptr, s_pos);
+    if (!quantum_ptr)
+      break;
+
+    /* write up to the end of this quantum */
+    chunk = min_t(size_t, count - done, quantum - q_pos);
+    copied = my_scull_copy_from_iov(it, quantum_ptr + q_pos, chunk);
+    done += copied;
+    if (copied < chunk) {
+      retval = -EFAULT;
+      break;
+    }
+
+    /* move on to the start of the next quantum */
+    q_pos = 0;
+    if (++s_pos == qset) {
+      s_pos = 0;
+      item++;
+      my_scull_qset_unlock(store->dev, dataptr);
+      dataptr = NULL;
+    }
+  }
+  if (dataptr)
+    my_scull_qset_unlock(store->dev, dataptr);
+
+  if (done || !count) {
+    my_scull_grow(store, pos + done);
+    retval = done;
+  }
+  return retval;
+}
+
+/*
+ * Free the quanta in [offset, offset + len). Parts of a quantum at
+ * either end of the range are zeroed instead. The size stays as it is.
+ *
+ * The caller keeps out trim, and whatever else might take the store
+ * apart alongside us; writers only need keeping out of each quantum set
+ * as we get to it.
+ */
+int my_scull_store_punch(struct my_scull_store *store, loff_t offset,
+                         loff_t len)
+{
+  struct my_scull_qset *dataptr;
+  struct my_scull_reap *reap;
+  void **data, *quantum_ptr;
+  unsigned long item;
+  int quantum = store->quantum, s_pos, q_pos;
+  loff_t pos = offset, end;
+  size_t chunk;
+  int retval = 0;
+
+  reap = my_scull_reap_alloc(store, GFP_KERNEL);
+  if (!reap)
+    return -ENOMEM;
+  end = min_t(loff_t, offset + len, store->size); /* nothing past the end */
+
+  while (pos < end) {
+    my_scull_decode(store, pos, &item, &s_pos, &q_pos);
+
+    dataptr = my_scull_lookup(store, item);
+    if (!dataptr) {
+      pos = my_scull_item_start(store, item + 1); /* the whole list item is a hole */
+      continue;
+    }
+    chunk = min_t(loff_t, end - pos, quantum - q_pos);
+
+    /* keep writers out of this quantum set while we take it apart */
+    if (mutex_lock_interruptible(&dataptr->lock)) {
+      retval = -ERESTARTSYS;
+      break;
+    }
+    my_scull_touch(store, dataptr);
+    data = dataptr->data;
+    if (data[s_pos]) {
+      if (chunk == quantum) {
+        quantum_ptr = xchg(&data[s_pos], NULL);
+        my_scull_reap_quantum(&reap, quantum_ptr);
+      } else {
+        memset(data[s_pos] + q_pos, 0, chunk);
+      }
+    }
+    mutex_unlock(&dataptr->lock);
+    pos += chunk;
+  }
+
+  my_scull_reap_done(reap);
+  return retval;
+}
+
+/*
+ * Set the size of the store. Growing it only leaves a hole; shrinking
+ * it frees everything past the new end, and zeroes the rest of the
+ * quantum the end falls in so that growing again reads back zeros.
+ *
+ * The caller has the store to itself, but for lockless readers.
+ */
+int my_scull_store_truncate(struct my_scull_store *store, loff_t size)
+{
+  struct my_scull_qset *dataptr, *batch[MY_SCULL_GANG];
+  struct my_scull_reap *reap;
+  void **data, *quantum_ptr;
+  unsigned long item;
+  int quantum = store->quantum, qset = store->qset, s_pos, q_pos;
+  unsigned int n, j;
+
+  if (size >= store->size) {
+    if (!my_scull_in_range(store, size))
+      return -EFBIG;
+    my_scull_grow(store, size);
+    return 0;
+  }
+  reap = my_scull_reap_alloc(store, GFP_KERNEL);
+  if (!reap)
+    return -ENOMEM;
+
+  /* a copy being made for re-chunking can't follow us */
+  if (store->rechunking)
+    store->rechunk_spoilt = 1;
+
+  /* readers stop at the new end before anything goes away */
+  spin_lock(&store->lock);
+  my_scull_set_size(store, size);
+  spin_unlock(&store->lock);
+
+  my_scull_decode(store, size, &item, &s_pos, &q_pos);
+
+  /* the list item the new end falls in keeps its head */
+  dataptr = my_scull_lookup(store, item);
+  if (dataptr) {
+    data = dataptr->data;
+    if (q_pos && data[s_pos])
+      memset(data[s_pos] + q_pos, 0, quantum - q_pos);
+    for (s_pos += !!q_pos; s_pos < qset; s_pos++) {
+      quantum_ptr = xchg(&data[s_pos], NULL);
+      if (quantum_ptr)
+        my_scull_reap_quantum(&reap, quantum_ptr);
+    }
+  }
+
+  /* and the ones after it go whole */
+  while (item != ULONG_MAX) {
+    rcu_read_lock();
+    n = radix_tree_gang_lookup(&store->index, (void **) batch,
+                               item + 1, MY_SCULL_GANG);
+    rcu_read_unlock();
+    if (!n)
+      break;
+    for (j = 0; j < n; j++) {
+      spin_lock(&store->lock);
+      radix_tree_delete(&store->index, batch[j]->item);
+      spin_unlock(&store->lock);
+      my_scull_reap_qset(&reap, batch[j]);
+    }
+  }
+
+  my_scull_reap_done(reap);
+  return 0;
+}
+
+/*
+ * Set up and tear down what all stores share. qset is the array size
+ * most stores will have, which gets a cache of its own.
+ */
+int my_scull_store_init(int qset)
+{
+  my_scull_qset_cache = kmem_cache_create("my_scull_qset",
+                                          my_scull_qset_size(qset), 0,
+                                          SLAB_HWCACHE_ALIGN, NULL);
+  if (!my_scull_qset_cache)
+    return -ENOMEM;
+  my_scull_cache_qset = qset;
+  return 0;
+}
+
+void my_scull_store_exit(void)
+{
+  int i;
+
+  if (my_scull_qset_cache)
+    kmem_cache_destroy(my_scull_qset_cache);
+  my_scull_qset_cache = NULL;
+  for (i = 0; i < MY_SCULL_QUANTUM_CACHES; i++) {
+    if (my_scull_quantum_caches[i].cache)
+      kmem_cache_destroy(my_scull_quantum_caches[i].cache);
+    my_scull_quantum_caches[i].quantum = 0;
+    my_scull_quantum_caches[i].cache = NULL;
+  }
+}